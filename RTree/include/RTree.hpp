@@ -1,6 +1,7 @@
 #pragma once
 
 #include "RTree/aabb.hpp"
+#include "RTree/arena_allocator.hpp"
 #include "RTree/geometry_traits.hpp"
 #include "RTree/iterator.hpp"
 #include "RTree/point.hpp"
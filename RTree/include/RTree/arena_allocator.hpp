@@ -0,0 +1,315 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/mman.h>
+#define EH_RTREE_ARENA_MMAP 1
+#endif
+
+namespace eh
+{
+namespace rtree
+{
+
+/*
+  slab allocator for tree nodes; use as Allocator parameter of RTree
+
+    RTree<BoundingBox, BoundingBox, Mapped, 4, 8, arena_allocator>
+
+  objects are carved one after another from large pages,
+  so nodes built together lie together in memory.
+  freed objects go to a free list and are reused by next allocate();
+  pages are returned to the system only by release() or destructor.
+
+  each allocator owns its pages; copies start with no pages,
+  and moves take the pages along.
+*/
+template <typename T>
+class arena_allocator
+{
+public:
+  using value_type = T;
+  using size_type = std::size_t;
+  using difference_type = std::ptrdiff_t;
+  using propagate_on_container_move_assignment = std::true_type;
+  using is_always_equal = std::false_type;
+
+  template <typename U>
+  struct rebind
+  {
+    using other = arena_allocator<U>;
+  };
+
+  constexpr static size_type DEFAULT_PAGE_BYTES = size_type(64) << 10;
+  // size of x86-64 huge page
+  constexpr static size_type HUGE_PAGE_BYTES = size_type(2) << 20;
+
+protected:
+  // free list is threaded through freed objects
+  struct free_node_t
+  {
+    free_node_t* next;
+  };
+  constexpr static size_type SLOT_BYTES
+      = sizeof(T) < sizeof(free_node_t) ? sizeof(free_node_t) : sizeof(T);
+  constexpr static size_type SLOT_ALIGN
+      = alignof(T) < alignof(free_node_t) ? alignof(free_node_t) : alignof(T);
+  constexpr static size_type SLOT_SIZE
+      = (SLOT_BYTES + SLOT_ALIGN - 1) / SLOT_ALIGN * SLOT_ALIGN;
+
+  struct page_t
+  {
+    void* pointer;
+    size_type bytes;
+    bool mapped;
+  };
+
+  std::vector<page_t> _pages;
+  // unused part of the last page
+  char* _cursor = nullptr;
+  char* _end = nullptr;
+  free_node_t* _free = nullptr;
+
+  size_type _page_bytes = DEFAULT_PAGE_BYTES;
+  bool _huge_pages = false;
+
+  // objects handed out and not deallocated yet
+  size_type _live = 0;
+
+  void* map_page(size_type bytes, bool& mapped)
+  {
+#ifdef EH_RTREE_ARENA_MMAP
+    mapped = true;
+    void* p = MAP_FAILED;
+#ifdef MAP_HUGETLB
+    if (_huge_pages)
+    {
+      // reserved huge pages; fails unless the system has some set aside
+      p = mmap(nullptr, bytes, PROT_READ | PROT_WRITE,
+               MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    }
+#endif
+    if (p == MAP_FAILED)
+    {
+      p = mmap(nullptr, bytes, PROT_READ | PROT_WRITE,
+               MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+      if (p == MAP_FAILED)
+      {
+        throw std::bad_alloc();
+      }
+#ifdef MADV_HUGEPAGE
+      if (_huge_pages)
+      {
+        // transparent huge pages; only a hint
+        madvise(p, bytes, MADV_HUGEPAGE);
+      }
+#endif
+    }
+    return p;
+#else
+    mapped = false;
+    return ::operator new(bytes);
+#endif
+  }
+  static void unmap_page(page_t const& page)
+  {
+#ifdef EH_RTREE_ARENA_MMAP
+    if (page.mapped)
+    {
+      munmap(page.pointer, page.bytes);
+      return;
+    }
+#endif
+    ::operator delete(page.pointer);
+  }
+
+  void new_page(size_type min_bytes)
+  {
+    size_type bytes = _page_bytes;
+    while (bytes < min_bytes)
+    {
+      bytes *= 2;
+    }
+    page_t page;
+    page.bytes = bytes;
+    page.pointer = map_page(bytes, page.mapped);
+    _pages.push_back(page);
+    _cursor = static_cast<char*>(page.pointer);
+    _end = _cursor + bytes;
+  }
+
+  void steal(arena_allocator& rhs)
+  {
+    _pages = std::move(rhs._pages);
+    _cursor = rhs._cursor;
+    _end = rhs._end;
+    _free = rhs._free;
+    _live = rhs._live;
+    _page_bytes = rhs._page_bytes;
+    _huge_pages = rhs._huge_pages;
+    rhs._pages.clear();
+    rhs._cursor = rhs._end = nullptr;
+    rhs._free = nullptr;
+    rhs._live = 0;
+  }
+
+public:
+  arena_allocator()
+  {
+  }
+  arena_allocator(arena_allocator const& rhs)
+      : _page_bytes(rhs._page_bytes)
+      , _huge_pages(rhs._huge_pages)
+  {
+  }
+  template <typename U>
+  arena_allocator(arena_allocator<U> const& rhs)
+      : _page_bytes(rhs.page_bytes())
+      , _huge_pages(rhs.huge_pages())
+  {
+  }
+  arena_allocator(arena_allocator&& rhs)
+  {
+    steal(rhs);
+  }
+  arena_allocator& operator=(arena_allocator const& rhs)
+  {
+    _page_bytes = rhs._page_bytes;
+    _huge_pages = rhs._huge_pages;
+    return *this;
+  }
+  arena_allocator& operator=(arena_allocator&& rhs)
+  {
+    if (this != &rhs)
+    {
+      release();
+      steal(rhs);
+    }
+    return *this;
+  }
+  ~arena_allocator()
+  {
+    release();
+  }
+
+  T* allocate(size_type n)
+  {
+    if (n == 1 && _free)
+    {
+      free_node_t* f = _free;
+      _free = f->next;
+      ++_live;
+      return reinterpret_cast<T*>(f);
+    }
+    const size_type bytes = n * SLOT_SIZE;
+    if (static_cast<size_type>(_end - _cursor) < bytes)
+    {
+      new_page(bytes);
+    }
+    T* ret = reinterpret_cast<T*>(_cursor);
+    _cursor += bytes;
+    _live += n;
+    return ret;
+  }
+  void deallocate(T* p, size_type n)
+  {
+    _live -= n;
+    if (n != 1)
+    {
+      // arrays are not reused; freed with the page
+      return;
+    }
+    free_node_t* f = reinterpret_cast<free_node_t*>(p);
+    f->next = _free;
+    _free = f;
+  }
+
+  // give every page back at once; objects are not destroyed.
+  // costs one call per page, not per object
+  void release()
+  {
+    for (page_t const& page : _pages)
+    {
+      unmap_page(page);
+    }
+    _pages.clear();
+    _cursor = _end = nullptr;
+    _free = nullptr;
+    _live = 0;
+  }
+
+  // size of newly mapped pages; takes effect from next page
+  void page_bytes(size_type bytes)
+  {
+    _page_bytes = bytes < SLOT_SIZE ? SLOT_SIZE : bytes;
+  }
+  size_type page_bytes() const
+  {
+    return _page_bytes;
+  }
+  // back new pages with huge pages if the system allows;
+  // fewer TLB misses while walking the tree
+  void huge_pages(bool enable)
+  {
+    _huge_pages = enable;
+    if (enable && _page_bytes < HUGE_PAGE_BYTES)
+    {
+      _page_bytes = HUGE_PAGE_BYTES;
+    }
+  }
+  bool huge_pages() const
+  {
+    return _huge_pages;
+  }
+
+  size_type page_count() const
+  {
+    return _pages.size();
+  }
+  // bytes taken from the system
+  size_type reserved_bytes() const
+  {
+    size_type ret = 0;
+    for (page_t const& page : _pages)
+    {
+      ret += page.bytes;
+    }
+    return ret;
+  }
+  // bytes of objects alive
+  size_type used_bytes() const
+  {
+    return _live * SLOT_SIZE;
+  }
+
+  bool operator==(arena_allocator const& rhs) const
+  {
+    return this == &rhs;
+  }
+  bool operator!=(arena_allocator const& rhs) const
+  {
+    return this != &rhs;
+  }
+};
+
+// allocator frees its objects all at once by release()
+template <typename Allocator, typename = void>
+struct is_arena_allocator : std::false_type
+{
+};
+template <typename Allocator>
+struct is_arena_allocator<
+    Allocator,
+    decltype(std::declval<Allocator&>().release(), void())>
+    : std::true_type
+{
+};
+
+}
+}
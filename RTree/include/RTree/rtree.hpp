@@ -2,12 +2,16 @@
 
 #include <algorithm>
 #include <cassert>
+#include <cmath>
+#include <iterator>
 #include <limits>
 #include <memory>
+#include <thread>
 #include <type_traits>
 #include <utility>
 #include <vector>
 
+#include "arena_allocator.hpp"
 #include "geometry_traits.hpp"
 #include "global.hpp"
 #include "iterator.hpp"
@@ -112,9 +116,25 @@ protected:
   allocator_type<node_type> _node_allocator;
   allocator_type<leaf_type> _leaf_allocator;
 
+  // nodes of arena allocators can be dropped together with their pages,
+  // if there is nothing to destroy in them
+  constexpr static bool RELEASE_AT_ONCE
+      = is_arena_allocator<allocator_type<node_type>>::value
+        && is_arena_allocator<allocator_type<leaf_type>>::value
+        && std::is_trivially_destructible<key_type>::value
+        && std::is_trivially_destructible<mapped_type>::value;
+
   void delete_if()
   {
-    if (_root)
+    if (_root == nullptr)
+    {
+      return;
+    }
+    if (RELEASE_AT_ONCE)
+    {
+      release_allocators(std::integral_constant<bool, RELEASE_AT_ONCE>());
+    }
+    else
     {
       if (_leaf_level == 0)
       {
@@ -129,6 +149,14 @@ protected:
       }
     }
   }
+  void release_allocators(std::true_type)
+  {
+    _node_allocator.release();
+    _leaf_allocator.release();
+  }
+  void release_allocators(std::false_type)
+  {
+  }
   void set_null()
   {
     _root = nullptr;
@@ -374,6 +402,129 @@ protected:
     }
   }
 
+  /*
+    Bulk Loading Scheme
+    Sort-Tile-Recursive packing, top-down variant
+
+    with P = ceil(N/M) nodes to be made, entries are cut into two tiles of
+    M*ceil(P/2) and the rest, along the axis where the sum of margins of the
+    two tiles is minimal (same criteria as R*-tree split axis).
+    each tile is cut recursively until it fits in a single node.
+    consecutive M entries of the resulting order forms a node, so only the very
+    last node could be underfull.
+
+    fixed x-y-z slabs of original STR produces long thin tiles on surface
+    meshes, which leads to more node visits in ray queries.
+
+    the two tiles are independent, so they are cut on separate threads
+    until `thread_count` runs out. the result is same as single thread.
+  */
+  // tiles smaller than this are not worth a new thread
+  constexpr static size_type BULK_LOAD_PARALLEL_SIZE = 4096;
+
+  template <typename EntryType>
+  static auto bulk_load_center(EntryType const& entry, int axis)
+  {
+    geometry_type const& bound = entry.first;
+    const auto c
+        = traits::min_point(bound, axis) + traits::max_point(bound, axis);
+    // unbounded on both sides; NaN would break the ordering
+    return c == c ? c : decltype(c) {};
+  }
+  template <typename RandomIt>
+  static void
+  bulk_load_tile(RandomIt first, RandomIt last, unsigned int thread_count)
+  {
+    using entry_type = typename std::iterator_traits<RandomIt>::value_type;
+    const size_type n = std::distance(first, last);
+    if (n <= MAX_ENTRIES)
+    {
+      return;
+    }
+    const size_type node_count = (n + MAX_ENTRIES - 1) / MAX_ENTRIES;
+    const size_type mid = MAX_ENTRIES * ((node_count + 1) / 2);
+    const auto partition = [&](int axis)
+    {
+      std::nth_element(first, first + mid, last,
+                       [axis](entry_type const& a, entry_type const& b)
+                       {
+                         return bulk_load_center(a, axis)
+                                < bulk_load_center(b, axis);
+                       });
+    };
+
+    // choose axis
+    int choose_axis = 0;
+    area_type min_margin = MAX_AREA;
+    for (int axis = 0; axis < traits::DIM; ++axis)
+    {
+      partition(axis);
+      geometry_type mbr1 = first->first;
+      for (auto it = first + 1; it != first + mid; ++it)
+      {
+        mbr1 = traits::merge(mbr1, it->first);
+      }
+      geometry_type mbr2 = (first + mid)->first;
+      for (auto it = first + mid + 1; it != last; ++it)
+      {
+        mbr2 = traits::merge(mbr2, it->first);
+      }
+      const auto margin = traits::margin(mbr1) + traits::margin(mbr2);
+      if (margin < min_margin)
+      {
+        min_margin = margin;
+        choose_axis = axis;
+      }
+    }
+    if (choose_axis != traits::DIM - 1)
+    {
+      partition(choose_axis);
+    }
+
+    if (thread_count > 1 && n >= BULK_LOAD_PARALLEL_SIZE)
+    {
+      const unsigned int half = thread_count / 2;
+      std::thread left([=]() { bulk_load_tile(first, first + mid, half); });
+      bulk_load_tile(first + mid, last, thread_count - half);
+      left.join();
+      return;
+    }
+    bulk_load_tile(first, first + mid, 1);
+    bulk_load_tile(first + mid, last, 1);
+  }
+  // pack entries into nodes of type `NodeType`
+  // returns (bound, node) pairs for the upper level
+  template <typename NodeType>
+  std::vector<typename node_type::value_type>
+  bulk_load_pack(std::vector<typename NodeType::value_type>& entries,
+                 unsigned int thread_count)
+  {
+    bulk_load_tile(entries.begin(), entries.end(), thread_count);
+
+    std::vector<typename node_type::value_type> packed;
+    packed.reserve((entries.size() + MAX_ENTRIES - 1) / MAX_ENTRIES);
+    const size_type n = entries.size();
+    size_type begin = 0;
+    while (begin < n)
+    {
+      size_type count = std::min(MAX_ENTRIES, n - begin);
+      // last node would have less than MIN_ENTRIES;
+      // split the remaining entries evenly into two nodes
+      if (n - begin > MAX_ENTRIES && n - begin - MAX_ENTRIES < MIN_ENTRIES)
+      {
+        count = (n - begin) / 2;
+      }
+      NodeType* node = construct_node<NodeType>();
+      for (size_type i = begin; i < begin + count; ++i)
+      {
+        node->insert(std::move(entries[i]));
+      }
+      packed.push_back({ node->calculate_bound(), node });
+      begin += count;
+    }
+    return packed;
+  }
+
 public:
   // set the number of reinserted nodes
   void reinsert_nodes(size_type count)
@@ -395,6 +546,47 @@ public:
     insert(value_type(std::forward<Args>(args)...));
   }
 
+  // build the tree from scratch with Sort-Tile-Recursive packing.
+  // existing entries are discarded.
+  // every node is filled up to MAX_ENTRIES (except the last one on each
+  // level), which gives less overlap than inserting one by one.
+  // thread_count: threads for sorting entries into tiles;
+  // nodes are allocated on the calling thread only
+  template <typename Iterator>
+  void bulk_load(Iterator first, Iterator last, unsigned int thread_count = 1)
+  {
+    delete_if();
+    set_null();
+
+    std::vector<value_type> values(first, last);
+    if (values.size() <= MAX_ENTRIES)
+    {
+      init_root();
+      for (auto& v : values)
+      {
+        _root->as_leaf()->insert(std::move(v));
+      }
+      return;
+    }
+
+    std::vector<typename node_type::value_type> entries
+        = bulk_load_pack<leaf_type>(values, thread_count);
+    int leaf_level = 1;
+    while (entries.size() > MAX_ENTRIES)
+    {
+      entries = bulk_load_pack<node_type>(entries, thread_count);
+      ++leaf_level;
+    }
+
+    node_type* root = construct_node<node_type>();
+    for (auto& e : entries)
+    {
+      root->insert(std::move(e));
+    }
+    _root = root;
+    _leaf_level = leaf_level;
+  }
+
   void erase(iterator pos)
   {
     leaf_type* leaf = pos._leaf;
@@ -541,7 +733,10 @@ public:
     _reinsert_nodes = rhs._reinsert_nodes;
     return *this;
   }
+  // allocators are moved along with the nodes they own
   RTree(RTree&& rhs)
+      : _node_allocator(std::move(rhs._node_allocator))
+      , _leaf_allocator(std::move(rhs._leaf_allocator))
   {
     _reinsert_nodes = rhs._reinsert_nodes;
     _root = rhs._root;
@@ -552,6 +747,8 @@ public:
   RTree& operator=(RTree&& rhs)
   {
     delete_if();
+    _node_allocator = std::move(rhs._node_allocator);
+    _leaf_allocator = std::move(rhs._leaf_allocator);
     _root = rhs._root;
     _leaf_level = rhs._leaf_level;
     _reinsert_nodes = rhs._reinsert_nodes;
@@ -0,0 +1,2152 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <iomanip>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <limits>
+#include <random>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "geometry.hpp"
+#include "mesh.hpp"
+#include "mesh_loader.hpp"
+#include "paged_mesh.hpp"
+#include "ray_sort.hpp"
+#include "reflection.hpp"
+#include "scene_cache.hpp"
+#include "stl_loader.hpp"
+#include "teapot_world.hpp"
+#include "wavefront.hpp"
+#include "world.hpp"
+
+// headless benchmarks for scene construction and traversal
+// usage: Benchmark
+//   [all|build|bvh|flat|order|simd|quantize|instance|refit|unbounded|mesh|
+//    intersect|occluded|packet|wavefront|coherence|layout|arena|parallel|
+//    cache|loader|ingest|ascii|import|paging|pathtrace]
+
+namespace
+{
+
+using clock_type = std::chrono::high_resolution_clock;
+using vec3 = eh::vec3;
+
+// elapsed time of functor in milliseconds
+template <typename Functor>
+float measure(Functor functor)
+{
+  auto t0 = clock_type::now();
+  functor();
+  return std::chrono::duration_cast<
+             std::chrono::duration<float, std::ratio<1, 1000>>>(
+             clock_type::now() - t0)
+      .count();
+}
+
+// teapot and floor, placed same as TeapotDemo
+struct TeapotScene
+{
+  eh::Triangle floor1 { vec3(-20.0f, -2.0f, 0.0f),  vec3(20.0f, -2.0f, 0.0f),
+                        vec3(-20.0f, -2.0f, -40.0f), vec3(0, 1, 0),
+                        vec3(0, 1, 0),               vec3(0, 1, 0) };
+  eh::Triangle floor2 { vec3(-20.0f, -2.0f, -40.0f), vec3(20.0f, -2.0f, 0.0f),
+                        vec3(20.0f, -2.0f, -40.0f),  vec3(0, 1, 0),
+                        vec3(0, 1, 0),               vec3(0, 1, 0) };
+  std::vector<eh::Triangle> teapot;
+  eh::DiffuseReflection material;
+
+  TeapotScene()
+  {
+    teapot = eh::load_stl(TEAPOT_PATH);
+    const vec3 offset(0.2f, -2.0f, -10.0f);
+    for (auto& t : teapot)
+    {
+      t.p0 += offset;
+      t.p1 += offset;
+      t.p2 += offset;
+    }
+  }
+
+  std::vector<eh::Object> objects()
+  {
+    std::vector<eh::Object> ret;
+    ret.reserve(teapot.size() + 2);
+    ret.push_back({ &floor1, &material });
+    ret.push_back({ &floor2, &material });
+    for (auto& t : teapot)
+    {
+      ret.push_back({ &t, &material });
+    }
+    return ret;
+  }
+
+  // n x n copies of teapot on the floor, for large scene
+  std::vector<eh::Triangle> grid;
+  std::vector<eh::Object> grid_objects(int n)
+  {
+    grid.clear();
+    grid.reserve(teapot.size() * n * n);
+    for (int i = 0; i < n; ++i)
+    {
+      for (int j = 0; j < n; ++j)
+      {
+        const vec3 offset(7.0f * (i - n / 2), 0.0f, -7.0f * j);
+        for (auto t : teapot)
+        {
+          t.p0 += offset;
+          t.p1 += offset;
+          t.p2 += offset;
+          grid.push_back(t);
+        }
+      }
+    }
+
+    std::vector<eh::Object> ret;
+    ret.reserve(grid.size() + 2);
+    ret.push_back({ &floor1, &material });
+    ret.push_back({ &floor2, &material });
+    for (auto& t : grid)
+    {
+      ret.push_back({ &t, &material });
+    }
+    return ret;
+  }
+
+  // n x n instances of one shared teapot mesh, placed same as grid_objects()
+  eh::TriangleMesh mesh;
+  std::vector<eh::MeshInstance> instances;
+  std::vector<eh::Object> instance_objects(int n)
+  {
+    if (mesh.size() == 0)
+    {
+      mesh.assign(teapot);
+    }
+    instances.clear();
+    instances.reserve(n * n);
+    for (int i = 0; i < n; ++i)
+    {
+      for (int j = 0; j < n; ++j)
+      {
+        const vec3 offset(7.0f * (i - n / 2), 0.0f, -7.0f * j);
+        instances.emplace_back(&mesh, offset);
+      }
+    }
+
+    std::vector<eh::Object> ret;
+    ret.reserve(instances.size() + 2);
+    ret.push_back({ &floor1, &material });
+    ret.push_back({ &floor2, &material });
+    for (auto& t : instances)
+    {
+      ret.push_back({ &t, &material });
+    }
+    return ret;
+  }
+};
+
+// camera of the workload, placed same as TeapotDemo
+eh::EyeAngle workload_camera()
+{
+  eh::EyeAngle camera;
+  camera.position({ 0.2, 4.0, 2.0 });
+  camera.angle({ -0.5, -0.0, 0 });
+  camera.perspective(3.141592f / 2.0f, 1.0f, 1.0f);
+  camera.move(2, 0.5f);
+  return camera;
+}
+
+// primary rays through pixel centers of TeapotDemo's camera,
+// followed by one random bounce ray from every primary hit
+std::vector<eh::Ray> make_workload(eh::World& world, int w, int h)
+{
+  const eh::EyeAngle camera = workload_camera();
+
+  std::vector<eh::Ray> rays;
+  rays.reserve(w * h * 2);
+  for (int y = 0; y < h; ++y)
+  {
+    for (int x = 0; x < w; ++x)
+    {
+      vec3 point = camera((x + 0.5f) / w, (y + 0.5f) / h);
+      rays.emplace_back(point, (point - camera(vec3(0, 0, 0))).normalized(),
+                        0);
+    }
+  }
+
+  std::mt19937 mt_twister { 1234 };
+  std::normal_distribution<float> dist;
+  const int primary_count = rays.size();
+  for (int i = 0; i < primary_count; ++i)
+  {
+    eh::RayHit hit = world.raycast(rays[i]);
+    if (hit.surface == nullptr)
+    {
+      continue;
+    }
+    vec3 d(dist(mt_twister), dist(mt_twister), dist(mt_twister));
+    d.normalize();
+    if (d.dot(hit.normal) < 0)
+    {
+      d = -d;
+    }
+    rays.emplace_back(hit.point(rays[i]), d, 0);
+  }
+  return rays;
+}
+
+// trace all rays, returns rays per second
+float trace_workload(eh::World& world, std::vector<eh::Ray> const& rays)
+{
+  int hit_count = 0;
+  const float ms = measure(
+      [&]()
+      {
+        for (auto const& r : rays)
+        {
+          if (world.raycast(r).surface)
+          {
+            ++hit_count;
+          }
+        }
+      });
+  std::cout << "  " << rays.size() << " rays, " << hit_count << " hits, "
+            << ms << " ms, " << rays.size() / ms * 1000.0f << " rays/sec\n";
+  return rays.size() / ms * 1000.0f;
+}
+
+// trace all rays with counters on, print nodes and primitives per ray
+eh::TraversalStats count_workload(eh::World& world,
+                                  std::vector<eh::Ray> const& rays)
+{
+  if (world.per_threads.empty())
+  {
+    world.init(1, 1, 1);
+  }
+  world.reset_traversal_stats();
+  world.collect_stats = true;
+  for (auto const& r : rays)
+  {
+    world.raycast(r);
+  }
+  world.collect_stats = false;
+
+  const auto stats = world.traversal_stats();
+  std::cout << "  " << (float)stats.nodes / rays.size() << " nodes/ray, "
+            << (float)stats.primitives / rays.size() << " primitives/ray\n";
+  return stats;
+}
+
+// node fill ratio and sibling overlap volume of the tree
+void print_tree_stats(eh::World::rtree_type const& tree)
+{
+  constexpr int M = eh::World::rtree_type::MAX_ENTRIES;
+
+  for (int level = 0; level <= tree.leaf_level(); ++level)
+  {
+    int node_count = 0;
+    int entry_count = 0;
+    float overlap = 0;
+    for (auto it = tree.begin(level); it != tree.end(level); ++it)
+    {
+      std::vector<eh::BoundingBox> bounds;
+      if (level == tree.leaf_level())
+      {
+        for (auto const& c : *it.node()->as_leaf())
+        {
+          bounds.push_back(c.first);
+        }
+      }
+      else
+      {
+        for (auto const& c : *it.node())
+        {
+          bounds.push_back(c.first);
+        }
+      }
+      for (std::size_t i = 0; i < bounds.size(); ++i)
+      {
+        for (std::size_t j = i + 1; j < bounds.size(); ++j)
+        {
+          const vec3 extent = bounds[i].max_.cwiseMin(bounds[j].max_)
+                              - bounds[i].min_.cwiseMax(bounds[j].min_);
+          overlap += extent.cwiseMax(0.0f).prod();
+        }
+      }
+      ++node_count;
+      entry_count += bounds.size();
+    }
+    std::cout << "  level " << level << ": " << node_count << " nodes, fill "
+              << 100.0f * entry_count / (node_count * M)
+              << "%, sibling overlap " << overlap << "\n";
+  }
+}
+
+// incremental R*-tree insertion vs. STR bulk-loading
+void bench_build(TeapotScene& scene)
+{
+  std::cout << "[build] " << scene.teapot.size() + 2 << " objects\n";
+  const auto objects = scene.objects();
+
+  eh::World inserted;
+  const float insert_ms = measure(
+      [&]()
+      {
+        for (auto const& o : objects)
+        {
+          inserted.insert(o);
+        }
+      });
+  eh::World bulk;
+  const float bulk_ms = measure([&]() { bulk.build(objects); });
+
+  const auto rays = make_workload(inserted, 256, 256);
+
+  std::cout << "incremental insert: " << insert_ms << " ms\n";
+  print_tree_stats(inserted.objects);
+  trace_workload(inserted, rays);
+
+  std::cout << "bulk load (STR): " << bulk_ms << " ms\n";
+  print_tree_stats(bulk.objects);
+  trace_workload(bulk, rays);
+  std::cout << "\n";
+}
+
+// bulk-loaded R-tree vs. SAH BVH backend
+void bench_bvh(TeapotScene& scene)
+{
+  std::cout << "[bvh] " << scene.teapot.size() + 2 << " objects\n";
+  const auto objects = scene.objects();
+
+  eh::World rtree;
+  const float rtree_ms = measure([&]() { rtree.build(objects); });
+  eh::World bvh;
+  const float bvh_ms = measure(
+      [&]() { bvh.build(objects, eh::World::Accelerator::BVH); });
+
+  const auto rays = make_workload(rtree, 256, 256);
+
+  std::cout << "rtree: build " << rtree_ms << " ms\n";
+  const float rtree_rays = trace_workload(rtree, rays);
+  std::cout << "bvh: build " << bvh_ms << " ms, " << bvh.bvh.nodes().size()
+            << " nodes\n";
+  const float bvh_rays = trace_workload(bvh, rays);
+  std::cout << "bvh / rtree: " << bvh_rays / rtree_rays << "x\n\n";
+}
+
+// pointer-linked R-tree vs. frozen, flattened R-tree
+void bench_flat(TeapotScene& scene)
+{
+  std::cout << "[flat] " << scene.teapot.size() + 2 << " objects\n";
+  eh::World world;
+  world.build(scene.objects());
+  const auto rays = make_workload(world, 256, 256);
+
+  std::cout << "rtree (recursive):\n";
+  const float rtree_rays = trace_workload(world, rays);
+  const float freeze_ms = measure([&]() { world.freeze(); });
+  std::cout << "flat rtree (iterative): freeze " << freeze_ms << " ms\n";
+  const float flat_rays = trace_workload(world, rays);
+  std::cout << "flat / rtree: " << flat_rays / rtree_rays << "x\n\n";
+}
+
+// storage-order vs. front-to-back child traversal
+void bench_order(eh::World& world, std::vector<eh::Ray> const& rays)
+{
+  for (bool ordered : { false, true })
+  {
+    world.ordered_traversal = ordered;
+    std::cout << (ordered ? "front-to-back:\n" : "storage order:\n");
+    count_workload(world, rays);
+    trace_workload(world, rays);
+  }
+  world.ordered_traversal = false;
+}
+void bench_order(TeapotScene& scene)
+{
+  std::cout << "[order] teapot, " << scene.teapot.size() + 2
+            << " objects\n";
+  {
+    eh::World world;
+    world.build(scene.objects(), eh::World::Accelerator::FlatRTree);
+    bench_order(world, make_workload(world, 256, 256));
+  }
+
+  const int n = 5;
+  const auto objects = scene.grid_objects(n);
+  std::cout << "[order] " << n << "x" << n << " teapots, " << objects.size()
+            << " objects\n";
+  eh::World world;
+  world.build(objects, eh::World::Accelerator::FlatRTree);
+  bench_order(world, make_workload(world, 256, 256));
+  std::cout << "\n";
+}
+
+// scalar slab test per child vs. SoA node tested by one SIMD pass
+void bench_simd(TeapotScene& scene)
+{
+  const int n = 5;
+  const auto objects = scene.grid_objects(n);
+  std::cout << "[simd] " << n << "x" << n << " teapots, " << objects.size()
+            << " objects, "
+#if defined(__AVX__)
+            << "AVX\n";
+#elif defined(__SSE2__)
+            << "SSE\n";
+#else
+            << "scalar\n";
+#endif
+  eh::World world;
+  world.build(objects, eh::World::Accelerator::FlatRTree);
+  world.ordered_traversal = true;
+  const auto rays = make_workload(world, 256, 256);
+
+  std::cout << "flat rtree:\n";
+  count_workload(world, rays);
+  const float flat_rays = trace_workload(world, rays);
+  const float freeze_ms = measure(
+      [&]() { world.freeze(eh::World::Accelerator::SIMDRTree); });
+  std::cout << "simd rtree: freeze " << freeze_ms << " ms, "
+            << world.simd.nodes().size() << " nodes of "
+            << sizeof(eh::World::simd_tree_type::node_type) << " bytes\n";
+  count_workload(world, rays);
+  const float simd_rays = trace_workload(world, rays);
+  std::cout << "simd / flat: " << simd_rays / flat_rays << "x\n\n";
+}
+
+
+// flat_raycast() in the interface of other read-only trees
+struct flat_view_t
+{
+  eh::World::rtree_type::flatten_result_t const& tree;
+
+  template <typename Functor>
+  void raycast(eh::Ray const& ray,
+               eh::RayHit& cur,
+               Functor functor,
+               bool ordered,
+               eh::TraversalStats* stats = nullptr) const
+  {
+    eh::flat_raycast(tree, ray, cur, functor, ordered, stats);
+  }
+};
+
+// trace rays with read-only tree other than World's own
+// print nodes per ray and rays per second
+template <typename Tree>
+void trace_tree(eh::World& world,
+                Tree const& tree,
+                std::vector<eh::Ray> const& rays)
+{
+  eh::TraversalStats stats;
+  for (auto const& r : rays)
+  {
+    eh::RayHit hit;
+    hit.t = std::numeric_limits<float>::max();
+    tree.raycast(r, hit,
+                 [&](eh::Object const& obj, eh::RayHit& cur)
+                 { world.raycast_object(r, obj, cur); },
+                 world.ordered_traversal, &stats);
+  }
+  std::cout << "  " << (float)stats.nodes / rays.size() << " nodes/ray, "
+            << (float)stats.primitives / rays.size() << " primitives/ray\n";
+
+  int hit_count = 0;
+  const float ms = measure(
+      [&]()
+      {
+        for (auto const& r : rays)
+        {
+          eh::RayHit hit;
+          hit.t = std::numeric_limits<float>::max();
+          tree.raycast(r, hit,
+                       [&](eh::Object const& obj, eh::RayHit& cur)
+                       { world.raycast_object(r, obj, cur); },
+                       world.ordered_traversal);
+          if (hit.surface)
+          {
+            ++hit_count;
+          }
+        }
+      });
+  std::cout << "  " << rays.size() << " rays, " << hit_count << " hits, "
+            << ms << " ms, " << rays.size() / ms * 1000.0f << " rays/sec\n";
+}
+
+// memory footprint of each frozen tree layout vs. pointer-linked R-tree
+void bench_quantize(TeapotScene& scene)
+{
+  using rtree_type = eh::World::rtree_type;
+  using quantized16_type
+      = eh::QuantizedTree<eh::Object, std::uint16_t, rtree_type::MAX_ENTRIES>;
+
+  const int n = 5;
+  const auto objects = scene.grid_objects(n);
+  std::cout << "[quantize] " << n << "x" << n << " teapots, "
+            << objects.size() << " objects\n";
+  eh::World world;
+  world.build(objects, eh::World::Accelerator::QuantizedRTree);
+  world.ordered_traversal = true;
+  auto const& frozen = world.frozen;
+  quantized16_type quantized16;
+  quantized16.build(frozen);
+
+  // leaf nodes of pointer-linked tree hold the data
+  size_t leaf_count = 0;
+  for (auto const& node : world.quantized.nodes())
+  {
+    leaf_count += node.leaf;
+  }
+  const size_t node_count = frozen.nodes.size() - leaf_count;
+  const size_t data_bytes = frozen.data.size() * sizeof(eh::Object);
+  const auto print_bytes = [&](const char* name, size_t bytes)
+  {
+    std::cout << "  " << name << ": " << bytes / 1024 << " KiB, "
+              << (float)bytes / frozen.data.size() << " bytes/primitive\n";
+  };
+  std::cout << "memory (excluding " << sizeof(eh::Object)
+            << " bytes of data per primitive):\n";
+  print_bytes("static_node_t",
+              node_count * sizeof(rtree_type::node_type)
+                  + leaf_count * sizeof(rtree_type::leaf_type) - data_bytes);
+  print_bytes("flat",
+              frozen.nodes.size() * sizeof(frozen.nodes[0])
+                  + frozen.children_bound.size() * sizeof(eh::BoundingBox)
+                  + frozen.children.size() * sizeof(frozen.children[0]));
+  print_bytes("simd float",
+              frozen.nodes.size()
+                  * sizeof(eh::World::simd_tree_type::node_type));
+  print_bytes("quantized 16bit",
+              frozen.nodes.size() * sizeof(quantized16_type::node_type));
+  print_bytes("quantized 8bit",
+              frozen.nodes.size()
+                      * sizeof(eh::World::quantized_tree_type::node_type));
+
+  const auto rays = make_workload(world, 256, 256);
+  eh::World::simd_tree_type simd;
+  simd.build(frozen);
+  std::cout << "flat:\n";
+  trace_tree(world, flat_view_t { frozen }, rays);
+  std::cout << "simd float:\n";
+  trace_tree(world, simd, rays);
+  std::cout << "quantized 16bit:\n";
+  trace_tree(world, quantized16, rays);
+  std::cout << "quantized 8bit:\n";
+  trace_tree(world, world.quantized, rays);
+  std::cout << "\n";
+}
+
+// memory of mesh's vertices, faces and tree
+size_t mesh_bytes(eh::TriangleMesh const& m)
+{
+  return m.positions.size() * sizeof(vec3) + m.normals.size() * sizeof(vec3)
+         + m.faces.size() * sizeof(eh::TriangleMesh::face_t)
+         + m.material_ids.size() * sizeof(m.material_ids[0])
+         + m.records.size() * sizeof(eh::TriangleMesh::record_t)
+         + m.tree.nodes().size() * sizeof(m.tree.nodes()[0])
+         + m.tree.data().size() * sizeof(m.tree.data()[0]);
+}
+// memory of world's SIMDRTree and Objects in it
+size_t world_bytes(eh::World const& w)
+{
+  return w.simd.nodes().size() * sizeof(w.simd.nodes()[0])
+         + w.simd.data().size() * sizeof(eh::Object);
+}
+
+// flattened copies of teapot vs. instances of one shared mesh
+void bench_instance(TeapotScene& scene)
+{
+  for (int n : { 5, 12 })
+  {
+    std::cout << "[instance] " << n << "x" << n << " teapots\n";
+
+    const auto copies = scene.grid_objects(n);
+    eh::World copy_world;
+    const float copy_ms = measure(
+        [&]()
+        { copy_world.build(copies, eh::World::Accelerator::SIMDRTree); });
+    const size_t copy_bytes
+        = scene.grid.size() * sizeof(eh::Triangle) + world_bytes(copy_world);
+
+    scene.mesh = eh::TriangleMesh {};
+    const float mesh_ms = measure([&]() { scene.instance_objects(n); });
+    const auto instances = scene.instance_objects(n);
+    eh::World instance_world;
+    const float instance_ms = measure(
+        [&]()
+        {
+          instance_world.build(instances,
+                               eh::World::Accelerator::SIMDRTree);
+        });
+    const size_t instance_bytes
+        = mesh_bytes(scene.mesh)
+          + scene.instances.size() * sizeof(eh::MeshInstance)
+          + world_bytes(instance_world);
+
+    const auto rays = make_workload(copy_world, 256, 256);
+    std::cout << "copies: " << copies.size() << " objects, build " << copy_ms
+              << " ms, " << copy_bytes / 1024 << " KiB\n";
+    const float copy_rays = trace_workload(copy_world, rays);
+    std::cout << "instances: " << instances.size()
+              << " objects, build mesh " << mesh_ms << " ms + top-level "
+              << instance_ms << " ms, " << instance_bytes / 1024 << " KiB\n";
+    const float instance_rays = trace_workload(instance_world, rays);
+    std::cout << "instances / copies: " << instance_rays / copy_rays
+              << "x\n\n";
+  }
+}
+
+
+// updating tree of animated scene; every teapot drifts each frame
+void bench_refit(TeapotScene& scene)
+{
+  const int n = 3;
+  const int frames = 10;
+  const size_t teapot_size = scene.teapot.size();
+  std::cout << "[refit] " << n << "x" << n << " moving teapots, " << frames
+            << " frames\n";
+
+  std::mt19937 mt_twister { 99 };
+  std::normal_distribution<float> dist;
+  std::vector<vec3> velocity(n * n);
+  for (auto& v : velocity)
+  {
+    v = vec3(dist(mt_twister), 0.2f * dist(mt_twister), dist(mt_twister))
+        * 0.4f;
+  }
+  const auto step = [&]()
+  {
+    for (size_t i = 0; i < scene.grid.size(); ++i)
+    {
+      const vec3& v = velocity[i / teapot_size];
+      scene.grid[i].p0 += v;
+      scene.grid[i].p1 += v;
+      scene.grid[i].p2 += v;
+    }
+  };
+
+  // update: moves the world to the current state of scene.grid
+  // returns true if tree was built from scratch
+  const auto run = [&](const char* name, auto update)
+  {
+    const auto objects = scene.grid_objects(n);
+    eh::World world;
+    world.init(1, 1, std::thread::hardware_concurrency());
+    world.build(objects, eh::World::Accelerator::SIMDRTree);
+    const float initial_cost = world.sah_cost();
+
+    float ms = 0;
+    int rebuilds = 0;
+    for (int f = 0; f < frames; ++f)
+    {
+      step();
+      ms += measure([&]() { rebuilds += update(world, objects); });
+    }
+    std::cout << name << ": " << ms / frames << " ms/frame, " << rebuilds
+              << " rebuilds, SAH cost " << world.sah_cost() / initial_cost
+              << "x of initial\n";
+    trace_workload(world, make_workload(world, 256, 256));
+  };
+
+  // RTree::erase() + insert() of every object costs at least this
+  run("re-insert",
+      [](eh::World& world, std::vector<eh::Object> const& objects)
+      {
+        world.objects.clear();
+        for (auto const& obj : objects)
+        {
+          world.insert(obj);
+        }
+        world.freeze(eh::World::Accelerator::SIMDRTree);
+        return true;
+      });
+  run("rebuild",
+      [](eh::World& world, std::vector<eh::Object> const& objects)
+      {
+        world.build(objects, eh::World::Accelerator::SIMDRTree);
+        return true;
+      });
+  run("refit",
+      [](eh::World& world, std::vector<eh::Object> const&)
+      { return world.refit(); });
+  run("refit, rebuild at 1.25x cost",
+      [](eh::World& world, std::vector<eh::Object> const&)
+      { return world.refit(1.25f); });
+  std::cout << "\n";
+}
+
+
+// sky sphere and infinite plane inside the tree vs. tested separately
+void bench_unbounded(TeapotScene& scene)
+{
+  eh::Sphere skysphere { vec3::Zero(), 100.0f };
+  eh::Plane plane;
+  plane.center = vec3(0.0f, -2.5f, 0.0f);
+  plane.normal = vec3(0, 1, 0);
+
+  const int n = 5;
+  auto objects = scene.grid_objects(n);
+  objects.push_back({ &skysphere, &scene.material });
+  objects.push_back({ &plane, &scene.material });
+  std::cout << "[unbounded] " << n << "x" << n
+            << " teapots with sky sphere and plane, " << objects.size()
+            << " objects\n";
+
+  for (auto accel :
+       { eh::World::Accelerator::RTree, eh::World::Accelerator::SIMDRTree })
+  {
+    std::vector<eh::Ray> rays;
+    for (bool separate : { false, true })
+    {
+      eh::World world;
+      world.separate_unbounded = separate;
+      world.build(objects, accel);
+      if (rays.empty())
+      {
+        rays = make_workload(world, 256, 256);
+      }
+      std::cout << (accel == eh::World::Accelerator::RTree ? "rtree"
+                                                           : "simd rtree")
+                << (separate ? ", separated " : ", in tree ")
+                << world.unbounded.size() << " objects:\n";
+      count_workload(world, rays);
+      trace_workload(world, rays);
+    }
+  }
+  std::cout << "\n";
+}
+
+
+// triangle objects vs. one indexed mesh, for STL with vertex normals
+void bench_mesh(TeapotScene& scene)
+{
+  const int n = 5;
+  const auto teapot = eh::load_stl(TEAPOT_PATH, true);
+  std::vector<eh::Triangle> soup;
+  soup.reserve(teapot.size() * n * n);
+  for (int i = 0; i < n; ++i)
+  {
+    for (int j = 0; j < n; ++j)
+    {
+      const vec3 offset(0.2f + 7.0f * (i - n / 2), -2.0f, -10.0f - 7.0f * j);
+      for (auto t : teapot)
+      {
+        t.p0 += offset;
+        t.p1 += offset;
+        t.p2 += offset;
+        soup.push_back(t);
+      }
+    }
+  }
+  std::cout << "[mesh] " << n << "x" << n << " teapots, " << soup.size()
+            << " triangles\n";
+
+  std::vector<eh::Object> objects;
+  objects.push_back({ &scene.floor1, &scene.material });
+  objects.push_back({ &scene.floor2, &scene.material });
+  for (auto& t : soup)
+  {
+    objects.push_back({ &t, &scene.material });
+  }
+  eh::World triangle_world;
+  triangle_world.build(objects, eh::World::Accelerator::SIMDRTree);
+  const size_t triangle_bytes
+      = soup.size() * sizeof(eh::Triangle) + world_bytes(triangle_world);
+
+  eh::TriangleMesh mesh;
+  const float mesh_ms = measure([&]() { mesh.assign(soup); });
+  objects.resize(2);
+  objects.push_back({ &mesh, &scene.material });
+  eh::World mesh_world;
+  mesh_world.build(objects, eh::World::Accelerator::SIMDRTree);
+  const size_t indexed_bytes = mesh_bytes(mesh) + world_bytes(mesh_world);
+
+  const auto rays = make_workload(triangle_world, 256, 256);
+  std::cout << "triangle objects: " << triangle_bytes / 1024 << " KiB, "
+            << (float)triangle_bytes / soup.size() << " bytes/triangle\n";
+  const float triangle_rays = trace_workload(triangle_world, rays);
+  std::cout << "indexed mesh: " << mesh.positions.size() << " vertices, "
+            << "assign " << mesh_ms << " ms, " << indexed_bytes / 1024
+            << " KiB, " << (float)indexed_bytes / soup.size()
+            << " bytes/triangle\n";
+  const float mesh_rays = trace_workload(mesh_world, rays);
+  std::cout << "memory triangle / mesh: "
+            << (float)triangle_bytes / indexed_bytes
+            << "x, rays/sec mesh / triangle: " << mesh_rays / triangle_rays
+            << "x\n";
+
+  // same mesh with record_t stored for each triangle
+  eh::TriangleMesh record_mesh;
+  record_mesh.precompute_records = true;
+  record_mesh.assign(soup);
+  objects.back() = { &record_mesh, &scene.material };
+  eh::World record_world;
+  record_world.build(objects, eh::World::Accelerator::SIMDRTree);
+  const size_t record_bytes
+      = mesh_bytes(record_mesh) + world_bytes(record_world);
+  std::cout << "indexed mesh, precomputed records: " << record_bytes / 1024
+            << " KiB, " << (float)record_bytes / soup.size()
+            << " bytes/triangle\n";
+  const float record_rays = trace_workload(record_world, rays);
+  std::cout << "rays/sec records / no records: " << record_rays / mesh_rays
+            << "x\n\n";
+}
+
+
+// Triangle::raycast() vs. precomputed record with deferred normal,
+// every ray against every triangle of the teapot
+void bench_intersect(TeapotScene& scene)
+{
+  const auto& triangles = scene.teapot;
+  eh::TriangleMesh mesh;
+  mesh.precompute_records = true;
+  mesh.assign(triangles);
+  // called through the interface, same as World does
+  std::vector<eh::GeometryObject const*> geometries;
+  for (auto const& t : triangles)
+  {
+    geometries.push_back(&t);
+  }
+
+  eh::World world;
+  world.build(scene.objects());
+  auto rays = make_workload(world, 32, 32);
+  std::cout << "[intersect] " << rays.size() << " rays x " << triangles.size()
+            << " triangles\n";
+  const float tests = (float)rays.size() * triangles.size();
+
+  int triangle_hits = 0;
+  const float triangle_ms = measure(
+      [&]()
+      {
+        for (auto const& r : rays)
+        {
+          eh::RayHit closest = eh::RayHit::no_hit();
+          for (auto const* g : geometries)
+          {
+            const eh::RayHit hit = g->raycast(r);
+            if (hit.surface && hit.t < closest.t)
+            {
+              closest = hit;
+            }
+          }
+          triangle_hits += closest.surface != nullptr;
+        }
+      });
+  std::cout << "Triangle::raycast: " << triangle_hits << " hits, "
+            << triangle_ms << " ms, " << tests / triangle_ms / 1000.0f
+            << " M tests/sec\n";
+
+  int record_hits = 0;
+  const float record_ms = measure(
+      [&]()
+      {
+        for (auto const& r : rays)
+        {
+          float tmax = std::numeric_limits<float>::infinity();
+          eh::TriangleMesh::index_type face = 0;
+          float hit_u = 0, hit_v = 0;
+          for (eh::TriangleMesh::index_type i = 0; i < mesh.records.size();
+               ++i)
+          {
+            float t, u, v;
+            vec3 const& p0 = mesh.positions[mesh.faces[i].v[0]];
+            if (mesh.records[i].intersect(p0, r, tmax, t, u, v))
+            {
+              tmax = t;
+              face = i;
+              hit_u = u;
+              hit_v = v;
+            }
+          }
+          if (tmax == std::numeric_limits<float>::infinity())
+          {
+            continue;
+          }
+          auto const& f = mesh.faces[face];
+          vec3 const& n0 = mesh.normals[f.v[0]];
+          const vec3 n = (n0 + (mesh.normals[f.v[1]] - n0) * hit_u
+                          + (mesh.normals[f.v[2]] - n0) * hit_v)
+                             .normalized();
+          record_hits += n.allFinite();
+        }
+      });
+  std::cout << "record + deferred normal: " << record_hits << " hits, "
+            << record_ms << " ms, " << tests / record_ms / 1000.0f
+            << " M tests/sec\n";
+  std::cout << "record / Triangle: " << triangle_ms / record_ms << "x\n\n";
+}
+
+
+
+// shadow rays toward a point light: closest-hit raycast() vs. any-hit
+// occluded(), for each accelerator
+void bench_occluded(eh::World& world,
+                    std::vector<eh::Ray> const& rays,
+                    std::vector<float> const& distances)
+{
+  int closest_count = 0, any_count = 0;
+  const float closest_ms = measure(
+      [&]()
+      {
+        for (size_t i = 0; i < rays.size(); ++i)
+        {
+          closest_count += world.raycast(rays[i]).t < distances[i];
+        }
+      });
+  const float any_ms = measure(
+      [&]()
+      {
+        for (size_t i = 0; i < rays.size(); ++i)
+        {
+          any_count += world.occluded(rays[i], distances[i]);
+        }
+      });
+
+  world.reset_traversal_stats();
+  world.collect_stats = true;
+  for (size_t i = 0; i < rays.size(); ++i)
+  {
+    world.raycast(rays[i]);
+  }
+  const auto closest_stats = world.traversal_stats();
+  world.reset_traversal_stats();
+  for (size_t i = 0; i < rays.size(); ++i)
+  {
+    world.occluded(rays[i], distances[i]);
+  }
+  const auto any_stats = world.traversal_stats();
+  world.collect_stats = false;
+
+  std::cout << "  closest-hit: " << closest_count << " occluded, "
+            << closest_ms << " ms, "
+            << (float)closest_stats.nodes / rays.size() << " nodes/ray, "
+            << (float)closest_stats.primitives / rays.size()
+            << " primitives/ray\n";
+  std::cout << "  any-hit:     " << any_count << " occluded, " << any_ms
+            << " ms, " << (float)any_stats.nodes / rays.size()
+            << " nodes/ray, " << (float)any_stats.primitives / rays.size()
+            << " primitives/ray\n";
+  std::cout << "  any / closest: " << closest_ms / any_ms << "x\n";
+}
+void bench_occluded(TeapotScene& scene)
+{
+  const vec3 light(3.0f, 8.0f, -6.0f);
+  const auto run = [&](char const* name, std::vector<eh::Object> const& objs)
+  {
+    eh::World world;
+    world.init(1, 1, 1);
+    world.build(objs);
+
+    // from every hit of the workload to the light
+    std::vector<eh::Ray> rays;
+    std::vector<float> distances;
+    for (auto const& r : make_workload(world, 256, 256))
+    {
+      const eh::RayHit hit = world.raycast(r);
+      if (hit.surface == nullptr)
+      {
+        continue;
+      }
+      const vec3 p = hit.point(r);
+      distances.push_back((light - p).norm());
+      rays.emplace_back(p, (light - p) / distances.back(), 0);
+    }
+    std::cout << "[occluded] " << name << ", " << rays.size()
+              << " shadow rays\n";
+
+    using accel = eh::World::Accelerator;
+    const std::pair<char const*, accel> accelerators[] = {
+      { "rtree", accel::RTree },         { "flat", accel::FlatRTree },
+      { "simd", accel::SIMDRTree },      { "quantized", accel::QuantizedRTree },
+      { "bvh", accel::BVH },
+    };
+    for (auto const& a : accelerators)
+    {
+      world.build(objs, a.second);
+      std::cout << " " << a.first << ":\n";
+      bench_occluded(world, rays, distances);
+    }
+    std::cout << "\n";
+  };
+  run("teapot triangles", scene.objects());
+  run("5x5 teapot instances", scene.instance_objects(5));
+}
+
+
+
+// jittered primary rays, 4 per pixel as World::render_pixel() shoots;
+// rays of a pixel are consecutive, so any 4 (or 8) rays form a packet
+// over one pixel (or two neighbouring pixels)
+std::vector<eh::Ray> make_primary_rays(int w, int h, int samples)
+{
+  const eh::EyeAngle camera = workload_camera();
+
+  std::mt19937 mt_twister { 1234 };
+  std::uniform_real_distribution<float> dist { 0.0f, 1.0f };
+  std::vector<eh::Ray> rays;
+  rays.reserve(w * h * samples);
+  for (int y = 0; y < h; ++y)
+  {
+    for (int x = 0; x < w; ++x)
+    {
+      for (int k = 0; k < samples; ++k)
+      {
+        vec3 point
+            = camera((x + dist(mt_twister)) / w, (y + dist(mt_twister)) / h);
+        rays.emplace_back(point, (point - camera(vec3(0, 0, 0))).normalized(),
+                          0);
+      }
+    }
+  }
+  return rays;
+}
+
+// trace rays in packets of N, returns rays per second
+template <unsigned int N>
+float trace_packets(eh::World& world,
+                    std::vector<eh::Ray> const& rays,
+                    std::vector<eh::RayHit>& hits)
+{
+  hits.resize(rays.size());
+  const float ms = measure(
+      [&]()
+      {
+        for (size_t i = 0; i < rays.size(); i += N)
+        {
+          const unsigned int count
+              = std::min<size_t>(N, rays.size() - i);
+          world.raycast_packet<N>(rays.data() + i, count, hits.data() + i);
+        }
+      });
+
+  world.reset_traversal_stats();
+  world.collect_stats = true;
+  for (size_t i = 0; i < rays.size(); i += N)
+  {
+    const unsigned int count = std::min<size_t>(N, rays.size() - i);
+    world.raycast_packet<N>(rays.data() + i, count, hits.data() + i);
+  }
+  world.collect_stats = false;
+  const auto stats = world.traversal_stats();
+
+  std::cout << "  " << ms << " ms, " << rays.size() / ms * 1000.0f
+            << " rays/sec, " << (float)stats.nodes / rays.size()
+            << " node fetches/ray, " << (float)stats.primitives / rays.size()
+            << " primitives/ray\n";
+  return rays.size() / ms * 1000.0f;
+}
+
+// single-ray vs. 4 and 8-ray packet traversal of primary rays
+void bench_packet(char const* name, std::vector<eh::Object> const& objs)
+{
+  eh::World world;
+  world.init(1, 1, 1);
+  world.build(objs, eh::World::Accelerator::SIMDRTree);
+  const auto rays = make_primary_rays(256, 256, 4);
+  std::cout << "[packet] " << name << ", " << rays.size()
+            << " primary rays\n";
+
+  std::vector<eh::RayHit> single(rays.size());
+  std::cout << " single ray:\n";
+  count_workload(world, rays);
+  const float single_rays = trace_workload(world, rays);
+  for (size_t i = 0; i < rays.size(); ++i)
+  {
+    single[i] = world.raycast(rays[i]);
+  }
+
+  std::vector<eh::RayHit> hits;
+  const auto mismatches = [&]()
+  {
+    int ret = 0;
+    for (size_t i = 0; i < rays.size(); ++i)
+    {
+      ret += single[i].surface != hits[i].surface || single[i].t != hits[i].t;
+    }
+    return ret;
+  };
+  std::cout << " packet of 4:\n";
+  const float packet4_rays = trace_packets<4>(world, rays, hits);
+  std::cout << "  " << mismatches() << " mismatches\n";
+  std::cout << " packet of 8:\n";
+  const float packet8_rays = trace_packets<8>(world, rays, hits);
+  std::cout << "  " << mismatches() << " mismatches\n";
+  std::cout << " packet / single: " << packet4_rays / single_rays << "x (4), "
+            << packet8_rays / single_rays << "x (8)\n\n";
+}
+void bench_packet(TeapotScene& scene)
+{
+  bench_packet("teapot triangles", scene.objects());
+  bench_packet("5x5 teapot instances", scene.instance_objects(5));
+}
+
+
+
+// recursive World::render_pixel() vs. WavefrontRenderer on TeapotDemo,
+// same number of passes; mean color should agree within noise
+void bench_wavefront(TeapotScene&)
+{
+  const int w = 64, h = 64, passes = 4;
+  TeapotDemo world(w, h, std::thread::hardware_concurrency());
+  world.freeze(eh::World::Accelerator::SIMDRTree);
+  world.packet_traversal = false;
+  // fewer diffuse rays, so that both finish in seconds
+  world.reflections.diffusive.sample_count = 3;
+  world.reflections.floor_diffuse.sample_count = 3;
+  std::cout << "[wavefront] " << w << "x" << h << " TeapotDemo, "
+            << world.shoot_count << " rays/pixel, " << passes << " passes\n";
+
+  const auto mean = [&]() -> vec3
+  {
+    vec3 ret = vec3::Zero();
+    for (auto const& c : world.framebuffer)
+    {
+      ret += c;
+    }
+    return ret / (float)world.framebuffer.size();
+  };
+
+  world.clear_framebuffer();
+  const float recursive_ms = measure(
+      [&]()
+      {
+        for (int p = 0; p < passes; ++p)
+        {
+          for (int i = 0; i < w * h; ++i)
+          {
+            world.render_pixel(i % w, i / w, 0);
+          }
+          ++world.sample_count;
+        }
+      });
+  const vec3 recursive_mean = mean();
+  std::cout << "recursive: " << recursive_ms << " ms, mean color "
+            << recursive_mean.transpose() << "\n";
+
+  eh::WavefrontRenderer wavefront(world);
+  float wavefront_ms = 0;
+  for (bool sort_rays : { false, true })
+  {
+    wavefront.sort_rays = sort_rays;
+    world.clear_framebuffer();
+    wavefront_ms = measure(
+        [&]()
+        {
+          for (int p = 0; p < passes; ++p)
+          {
+            wavefront.render();
+          }
+        });
+    std::cout << "wavefront" << (sort_rays ? ", sorted: " : ": ")
+              << wavefront_ms << " ms, mean color " << mean().transpose()
+              << "\n";
+  }
+  std::cout << "  rays per bounce:";
+  for (auto n : wavefront.queue_sizes)
+  {
+    std::cout << " " << n;
+  }
+  std::cout << "\n";
+  std::cout << "wavefront / recursive: " << recursive_ms / wavefront_ms
+            << "x\n\n";
+}
+
+
+
+// simulated L1, L2 and TLB misses on node and primitive fetches
+void count_cache_misses(eh::World& world, std::vector<eh::Ray> const& rays)
+{
+  struct cache_t
+  {
+    char const* name;
+    std::size_t bytes;
+    unsigned int ways;
+    std::size_t line_size;
+  };
+  const cache_t caches[] = {
+    { "32 KiB L1", 32 * 1024, 8, 64 },
+    { "1 MiB L2", 1024 * 1024, 16, 64 },
+    { "64-entry TLB", 64 * 4096, 4, 4096 },
+  };
+  std::cout << " ";
+  for (auto const& c : caches)
+  {
+    world.simulate_cache(c.bytes, c.ways, c.line_size);
+    world.reset_traversal_stats();
+    world.collect_stats = true;
+    for (auto const& r : rays)
+    {
+      world.raycast(r);
+    }
+    world.collect_stats = false;
+    std::cout << " " << c.name << " "
+              << (float)world.traversal_stats().cache_misses / rays.size();
+  }
+  std::cout << " misses/ray\n";
+  world.simulate_cache(0);
+}
+
+// diffuse bounce rays in pixel order vs. sorted by coherence_key()
+void bench_coherence(TeapotScene& scene)
+{
+  const int w = 256, h = 256;
+  eh::World world;
+  world.init(1, 1, 1);
+  world.build(scene.grid_objects(5), eh::World::Accelerator::SIMDRTree);
+
+  const auto workload = make_workload(world, w, h);
+  std::vector<eh::Ray> rays(workload.begin() + w * h, workload.end());
+  std::cout << "[coherence] 5x5 teapot grid, " << rays.size()
+            << " diffuse bounce rays\n";
+
+  std::vector<eh::Ray> sorted;
+  std::vector<std::uint32_t> order;
+  const float sort_ms = measure(
+      [&]()
+      {
+        eh::coherence_sort(rays, order);
+        sorted.reserve(rays.size());
+        for (auto i : order)
+        {
+          sorted.push_back(rays[i]);
+        }
+      });
+
+  std::vector<eh::RayHit> hits;
+  std::cout << "pixel order:\n";
+  count_workload(world, rays);
+  count_cache_misses(world, rays);
+  const float unsorted_rays = trace_workload(world, rays);
+  std::cout << " packet of 8:\n";
+  const float unsorted_packets = trace_packets<8>(world, rays, hits);
+
+  std::cout << "sorted: " << sort_ms << " ms to sort\n";
+  count_workload(world, sorted);
+  count_cache_misses(world, sorted);
+  const float sorted_rays = trace_workload(world, sorted);
+  std::cout << " packet of 8:\n";
+  const float sorted_packets = trace_packets<8>(world, sorted, hits);
+  std::cout << "sorted / pixel order: " << sorted_rays / unsorted_rays
+            << "x (single), " << sorted_packets / unsorted_packets
+            << "x (packet)\n\n";
+}
+
+
+
+// node order of the frozen tree, on same workload of a large scene
+void bench_layout(TeapotScene& scene)
+{
+  using accel = eh::World::Accelerator;
+  eh::World world;
+  world.init(1, 1, 1);
+  const auto objs = scene.grid_objects(5);
+  world.build(objs, accel::SIMDRTree);
+  const auto rays = make_workload(world, 256, 256);
+  std::cout << "[layout] 5x5 teapot grid, " << objs.size() << " objects\n";
+
+  struct layout_t
+  {
+    char const* name;
+    eh::TreeLayout layout;
+    std::size_t treelet_bytes;
+  };
+  const layout_t layouts[] = {
+    { "dfs", eh::TreeLayout::DFS, 0 },
+    { "bfs", eh::TreeLayout::BFS, 0 },
+    { "veb", eh::TreeLayout::VEB, 0 },
+    { "treelet 1 KiB", eh::TreeLayout::Treelet, 1024 },
+    { "treelet 4 KiB", eh::TreeLayout::Treelet, 4096 },
+  };
+  for (auto a : { accel::FlatRTree, accel::SIMDRTree })
+  {
+    for (auto const& l : layouts)
+    {
+      world.tree_layout = l.layout;
+      world.treelet_bytes = l.treelet_bytes;
+      world.freeze(a);
+      std::cout << (a == accel::FlatRTree ? "flat, " : "simd, ") << l.name
+                << ":\n";
+      count_workload(world, rays);
+      count_cache_misses(world, rays);
+      trace_workload(world, rays);
+    }
+  }
+  std::cout << "\n";
+}
+
+
+// R-tree over given node allocator, same parameters as World::rtree_type
+template <template <typename> class Allocator>
+using alloc_rtree_type = eh::rtree::
+    RTree<eh::BoundingBox, eh::BoundingBox, eh::Object, 4, 8, Allocator>;
+
+template <typename Tree>
+void raycast_alloc_tree(eh::Ray const& ray,
+                        typename Tree::node_type const* node,
+                        int leaf_level,
+                        eh::RayHit& cur)
+{
+  float tmin, tmax;
+  if (leaf_level == 0)
+  {
+    for (auto const& c : *node->as_leaf())
+    {
+      if (c.first.raycast(ray, tmin, tmax) && tmin <= cur.t)
+      {
+        const eh::RayHit hit = c.second.geometry->raycast(ray);
+        if (hit.surface && hit.t < cur.t)
+        {
+          cur = hit;
+        }
+      }
+    }
+    return;
+  }
+  for (auto const& c : *node)
+  {
+    if (c.first.raycast(ray, tmin, tmax) && tmin <= cur.t)
+    {
+      raycast_alloc_tree<Tree>(ray, c.second->as_node(), leaf_level - 1,
+                               cur);
+    }
+  }
+}
+
+// pages taken by arena allocators of the tree
+template <typename Tree>
+void print_arena_bytes(Tree&)
+{
+}
+void print_arena_bytes(alloc_rtree_type<eh::rtree::arena_allocator>& tree)
+{
+  std::cout << " in "
+            << (tree.node_allocator().reserved_bytes()
+                + tree.leaf_allocator().reserved_bytes())
+                   / 1024
+            << " KiB of " << tree.node_allocator().page_count()
+                   + tree.leaf_allocator().page_count()
+            << " pages";
+}
+
+// build, trace and clear R-tree with given node allocator
+// configure: called on the empty tree before building
+template <template <typename> class Allocator, typename Configure>
+void bench_arena(char const* name,
+                 std::vector<eh::Object> const& objects,
+                 std::vector<eh::Ray> const& rays,
+                 Configure configure)
+{
+  using tree_type = alloc_rtree_type<Allocator>;
+  std::vector<typename tree_type::value_type> values;
+  values.reserve(objects.size());
+  for (auto const& o : objects)
+  {
+    values.push_back({ o.geometry->bounding_box(), o });
+  }
+
+  std::cout << name << ":\n";
+  for (bool bulk : { false, true })
+  {
+    tree_type tree;
+    configure(tree);
+    const float build_ms = measure(
+        [&]()
+        {
+          if (bulk)
+          {
+            tree.bulk_load(values.begin(), values.end());
+            return;
+          }
+          for (auto const& v : values)
+          {
+            tree.insert(v);
+          }
+        });
+
+    std::size_t nodes = 0, leaves = 0;
+    for (int level = 0; level <= tree.leaf_level(); ++level)
+    {
+      for (auto it = tree.begin(level); it != tree.end(level); ++it)
+      {
+        ++(level == tree.leaf_level() ? leaves : nodes);
+      }
+    }
+    const std::size_t used = nodes * sizeof(typename tree_type::node_type)
+                             + leaves * sizeof(typename tree_type::leaf_type);
+
+    int hit_count = 0;
+    const float trace_ms = measure(
+        [&]()
+        {
+          for (auto const& r : rays)
+          {
+            eh::RayHit hit = eh::RayHit::no_hit();
+            raycast_alloc_tree<tree_type>(r, tree.root(), tree.leaf_level(),
+                                          hit);
+            hit_count += hit.surface != nullptr;
+          }
+        });
+
+    std::cout << "  " << (bulk ? "bulk load" : "insert") << ": build "
+              << build_ms << " ms, " << nodes + leaves << " nodes, "
+              << used / 1024 << " KiB of nodes";
+    print_arena_bytes(tree);
+    const float clear_ms = measure([&]() { tree.clear(); });
+    std::cout << "\n    " << rays.size() << " rays, " << hit_count
+              << " hits, " << trace_ms << " ms, clear " << clear_ms
+              << " ms\n";
+  }
+}
+
+// heap-allocated nodes vs. nodes carved from arena pages
+void bench_arena(TeapotScene& scene)
+{
+  const int n = 5;
+  const auto objects = scene.grid_objects(n);
+  std::cout << "[arena] " << n << "x" << n << " teapots, " << objects.size()
+            << " objects\n";
+  eh::World world;
+  world.build(objects);
+  const auto rays = make_workload(world, 256, 256);
+
+  bench_arena<std::allocator>("std::allocator", objects, rays,
+                              [](auto&) {});
+  bench_arena<eh::rtree::arena_allocator>("arena", objects, rays,
+                                          [](auto&) {});
+  bench_arena<eh::rtree::arena_allocator>(
+      "arena, huge pages", objects, rays,
+      [](auto& tree)
+      {
+        tree.node_allocator().huge_pages(true);
+        tree.leaf_allocator().huge_pages(true);
+      });
+  std::cout << "\n";
+}
+
+
+// bulk-loaded R-tree and BVH built with 1, 2, 4, 8 threads
+void bench_parallel(TeapotScene& scene)
+{
+  const int n = 10;
+  const auto objects = scene.grid_objects(n);
+  std::cout << "[parallel] " << n << "x" << n << " teapots, " << objects.size()
+            << " objects, " << std::thread::hardware_concurrency()
+            << " hardware threads\n";
+
+  using accel = eh::World::Accelerator;
+  for (auto a : { accel::RTree, accel::BVH })
+  {
+    float single_ms = 0;
+    for (int threads : { 1, 2, 4, 8 })
+    {
+      eh::World world;
+      world.init(1, 1, threads);
+      const float ms = measure([&]() { world.build(objects, a); });
+      if (threads == 1)
+      {
+        single_ms = ms;
+      }
+      // same tree for any thread count
+      std::cout << (a == accel::RTree ? "rtree" : "bvh") << ", " << threads
+                << " threads: build " << ms << " ms, " << single_ms / ms
+                << "x, sah cost " << world.sah_cost() << "\n";
+    }
+  }
+  std::cout << "\n";
+}
+
+
+// teapot mesh parsed and built from STL vs. loaded from scene cache
+void bench_cache(TeapotScene& scene)
+{
+  std::cout << "[cache] teapot mesh, " << scene.teapot.size()
+            << " triangles\n";
+  const std::string cache = MESH_CACHE_DIR "/bench_teapot.meshcache";
+  std::remove(cache.c_str());
+  const auto load
+      = [](eh::TriangleMesh& mesh) { eh::load_stl_mesh(TEAPOT_PATH, mesh); };
+
+  eh::TriangleMesh built, cached;
+  bool hit = true;
+  const float build_ms = measure(
+      [&]() { hit = eh::load_mesh_cached(built, TEAPOT_PATH, cache, load); });
+  std::cout << "no cache: " << build_ms << " ms, cache "
+            << (hit ? "hit" : "written") << "\n";
+  const float cached_ms = measure(
+      [&]() { hit = eh::load_mesh_cached(cached, TEAPOT_PATH, cache, load); });
+  std::cout << "cache: " << cached_ms << " ms, cache "
+            << (hit ? "hit" : "written") << ", "
+            << eh::FileStamp::of(cache).size / 1024 << " KiB, "
+            << build_ms / cached_ms << "x\n";
+
+  // other settings must not take the cache
+  eh::TriangleMesh other;
+  other.layout = eh::TreeLayout::BFS;
+  const bool other_hit
+      = eh::load_mesh_cache(cache, other, eh::FileStamp::of(TEAPOT_PATH));
+  std::cout << "other layout: cache " << (other_hit ? "hit" : "rejected")
+            << "\n";
+
+  // same hits from both meshes, placed same as TeapotDemo
+  const vec3 offset(0.2f, -2.0f, -10.0f);
+  eh::MeshInstance built_instance(&built, offset);
+  eh::MeshInstance cached_instance(&cached, offset);
+  eh::World world;
+  world.build({ { &built_instance, &scene.material } });
+  const auto rays = make_workload(world, 128, 128);
+  int mismatches = 0;
+  for (auto const& r : rays)
+  {
+    const eh::RayHit a = built_instance.raycast(r);
+    const eh::RayHit b = cached_instance.raycast(r);
+    if ((a.surface == nullptr) != (b.surface == nullptr)
+        || (a.surface && a.t != b.t))
+    {
+      ++mismatches;
+    }
+  }
+  std::cout << "  " << rays.size() << " rays, " << mismatches
+            << " mismatches\n\n";
+  std::remove(cache.c_str());
+}
+
+
+// vertex normals of load_stl() before vertex welding; O(n^2) reference
+std::vector<eh::Triangle>
+smooth_normals_quadratic(std::vector<eh::Triangle> triangles)
+{
+  std::vector<std::pair<vec3, vec3>> corners;
+  for (auto const& t : triangles)
+  {
+    corners.push_back({ t.p0, t.n0 });
+    corners.push_back({ t.p1, t.n1 });
+    corners.push_back({ t.p2, t.n2 });
+  }
+  const auto average = [&](vec3 const& p)
+  {
+    vec3 normal = vec3::Zero();
+    for (auto const& c : corners)
+    {
+      if ((p - c.first).squaredNorm() < 1e-6)
+      {
+        normal += c.second;
+      }
+    }
+    return normal.normalized();
+  };
+  for (auto& t : triangles)
+  {
+    t.n0 = average(t.p0);
+    t.n1 = average(t.p1);
+    t.n2 = average(t.p2);
+  }
+  return triangles;
+}
+
+// load_stl() with and without vertex normals, over n copies of teapot
+void bench_loader(TeapotScene& scene)
+{
+  std::cout << "[loader] binary STL, copies of teapot\n";
+  const std::string filename = "bench_loader.stl";
+  for (int n : { 1, 4, 16, 64 })
+  {
+    std::vector<eh::Triangle> triangles;
+    for (int i = 0; i < n; ++i)
+    {
+      const vec3 offset(7.0f * i, 0.0f, 0.0f);
+      for (auto t : scene.teapot)
+      {
+        t.p0 += offset;
+        t.p1 += offset;
+        t.p2 += offset;
+        triangles.push_back(t);
+      }
+    }
+    eh::write_stl(filename, triangles);
+
+    std::vector<eh::Triangle> flat, smooth;
+    const float flat_ms
+        = measure([&]() { flat = eh::load_stl(filename, false); });
+    const float smooth_ms
+        = measure([&]() { smooth = eh::load_stl(filename, true); });
+    std::cout << triangles.size() << " triangles: face normals " << flat_ms
+              << " ms, vertex normals " << smooth_ms << " ms\n";
+
+    // quadratic one takes too long beyond this
+    if (n == 1)
+    {
+      std::vector<eh::Triangle> reference;
+      const float quadratic_ms = measure(
+          [&]() { reference = smooth_normals_quadratic(flat); });
+      float max_error = 0;
+      for (std::size_t i = 0; i < smooth.size(); ++i)
+      {
+        max_error = std::max({ max_error,
+                               (smooth[i].n0 - reference[i].n0).norm(),
+                               (smooth[i].n1 - reference[i].n1).norm(),
+                               (smooth[i].n2 - reference[i].n2).norm() });
+      }
+      std::cout << "  O(n^2) vertex normals " << quadratic_ms
+                << " ms, max difference " << max_error << "\n";
+    }
+  }
+  std::remove(filename.c_str());
+  std::cout << "\n";
+}
+
+
+// load_stl() before memory mapping; one stream read per field
+std::vector<eh::Triangle> load_stl_stream(std::string const& filename)
+{
+  std::ifstream ifs(filename, std::ios::binary);
+  ifs.seekg(80, std::ios::beg);
+  uint32_t triangle_count;
+  ifs.read((char*)&triangle_count, 4);
+  std::vector<eh::Triangle> triangles(triangle_count);
+  for (auto& t : triangles)
+  {
+    vec3 normal;
+    ifs.read((char*)&normal, 12);
+    ifs.read((char*)t.p0.data(), 12);
+    ifs.read((char*)t.p1.data(), 12);
+    ifs.read((char*)t.p2.data(), 12);
+    t.n0 = t.n1 = t.n2 = (t.p1 - t.p0).cross(t.p2 - t.p0).normalized();
+    ifs.seekg(2, std::ios::cur);
+  }
+  return triangles;
+}
+
+// binary STL ingest throughput, stream reads vs. memory mapped
+void bench_ingest(TeapotScene& scene)
+{
+  std::cout << "[ingest] binary STL, copies of teapot, "
+            << std::thread::hardware_concurrency() << " hardware threads\n";
+  const std::string filename = "bench_ingest.stl";
+  for (int n : { 16, 256 })
+  {
+    std::vector<eh::Triangle> triangles;
+    triangles.reserve(scene.teapot.size() * n);
+    for (int i = 0; i < n; ++i)
+    {
+      for (auto const& t : scene.teapot)
+      {
+        triangles.push_back(t);
+      }
+    }
+    eh::write_stl(filename, triangles);
+    triangles.clear();
+    triangles.shrink_to_fit();
+    const float mb = eh::FileStamp::of(filename).size / 1.0e6f;
+
+    std::vector<eh::Triangle> stream, mapped;
+    std::vector<vec3> positions;
+    const float stream_ms
+        = measure([&]() { stream = load_stl_stream(filename); });
+    stream.clear();
+    stream.shrink_to_fit();
+    const float mapped_ms
+        = measure([&]() { mapped = eh::load_stl(filename); });
+    mapped.clear();
+    mapped.shrink_to_fit();
+    const float positions_ms
+        = measure([&]() { positions = eh::load_stl_positions(filename); });
+
+    std::cout << mb << " MB:\n";
+    std::cout << "  stream, triangles: " << stream_ms << " ms, "
+              << mb / stream_ms * 1000.0f << " MB/s\n";
+    std::cout << "  mmap, triangles:   " << mapped_ms << " ms, "
+              << mb / mapped_ms * 1000.0f << " MB/s\n";
+    std::cout << "  mmap, positions:   " << positions_ms << " ms, "
+              << mb / positions_ms * 1000.0f << " MB/s\n";
+  }
+  std::remove(filename.c_str());
+  std::cout << "\n";
+}
+
+
+// ASCII STL with full float precision, so it reads back exactly
+void write_stl_ascii(std::string const& filename,
+                     std::vector<eh::Triangle> const& triangles)
+{
+  std::ofstream ofs(filename);
+  ofs << std::setprecision(9) << "solid bench\n";
+  for (auto const& t : triangles)
+  {
+    ofs << " facet normal " << t.n0.x() << ' ' << t.n0.y() << ' '
+        << t.n0.z() << "\n  outer loop\n";
+    for (vec3 const* p : { &t.p0, &t.p1, &t.p2 })
+    {
+      ofs << "   vertex " << p->x() << ' ' << p->y() << ' ' << p->z()
+          << '\n';
+    }
+    ofs << "  endloop\n endfacet\n";
+  }
+  ofs << "endsolid bench\n";
+}
+
+// ASCII STL read word by word with operator>>, on one thread
+std::vector<eh::Triangle> load_stl_ascii_stream(std::string const& filename)
+{
+  std::ifstream ifs(filename);
+  std::vector<eh::Triangle> triangles;
+  std::string word;
+  vec3 v[3];
+  int vertex_count = 0;
+  while (ifs >> word)
+  {
+    if (word == "vertex")
+    {
+      ifs >> v[vertex_count].x() >> v[vertex_count].y()
+          >> v[vertex_count].z();
+      ++vertex_count;
+    }
+    else if (word == "endfacet")
+    {
+      const vec3 n = (v[1] - v[0]).cross(v[2] - v[0]).normalized();
+      triangles.emplace_back(v[0], v[1], v[2], n, n, n);
+      vertex_count = 0;
+    }
+  }
+  return triangles;
+}
+
+// ASCII STL parse throughput, operator>> vs. parallel from_chars
+void bench_ascii(TeapotScene& scene)
+{
+  std::cout << "[ascii] ASCII STL, copies of teapot, "
+            << std::thread::hardware_concurrency() << " hardware threads\n";
+  const std::string binary = "bench_ascii.stl";
+  const std::string ascii = "bench_ascii.txt.stl";
+  for (int n : { 16, 128 })
+  {
+    std::vector<eh::Triangle> triangles;
+    triangles.reserve(scene.teapot.size() * n);
+    for (int i = 0; i < n; ++i)
+    {
+      for (auto const& t : scene.teapot)
+      {
+        triangles.push_back(t);
+      }
+    }
+    eh::write_stl(binary, triangles);
+    write_stl_ascii(ascii, triangles);
+    triangles.clear();
+    triangles.shrink_to_fit();
+    const float mb = eh::FileStamp::of(ascii).size / 1.0e6f;
+
+    std::vector<eh::Triangle> stream, parsed, reference;
+    const float stream_ms
+        = measure([&]() { stream = load_stl_ascii_stream(ascii); });
+    stream.clear();
+    stream.shrink_to_fit();
+    const float parsed_ms = measure([&]() { parsed = eh::load_stl(ascii); });
+
+    // same triangles as the binary file, bit for bit;
+    // degenerate triangles have NaN normals, so not compared with ==
+    reference = eh::load_stl(binary);
+    std::size_t mismatches = parsed.size() == reference.size()
+                                 ? 0
+                                 : std::max(parsed.size(), reference.size());
+    for (std::size_t i = 0; i < parsed.size() && i < reference.size(); ++i)
+    {
+      eh::Triangle const& a = parsed[i];
+      eh::Triangle const& b = reference[i];
+      for (auto m : { &eh::Triangle::p0, &eh::Triangle::p1, &eh::Triangle::p2,
+                      &eh::Triangle::n0 })
+      {
+        if (std::memcmp((a.*m).data(), (b.*m).data(), sizeof(vec3)) != 0)
+        {
+          ++mismatches;
+          break;
+        }
+      }
+    }
+
+    std::cout << mb << " MB, " << parsed.size() << " triangles:\n";
+    std::cout << "  operator>>:          " << stream_ms << " ms, "
+              << mb / stream_ms * 1000.0f << " MB/s\n";
+    std::cout << "  parallel from_chars: " << parsed_ms << " ms, "
+              << mb / parsed_ms * 1000.0f << " MB/s\n";
+    std::cout << "  mismatches with binary: " << mismatches << "\n";
+  }
+  std::remove(binary.c_str());
+  std::remove(ascii.c_str());
+  std::cout << "\n";
+}
+
+
+// STL with welding vs. indexed OBJ and PLY, over n x n copies of teapot
+void bench_import(TeapotScene& scene)
+{
+  std::cout << "[import] STL, OBJ and binary PLY of teapot copies\n";
+  eh::TriangleMesh teapot;
+  eh::load_stl_mesh(TEAPOT_PATH, teapot);
+  const std::string stl = "bench_import.stl";
+  const std::string obj = "bench_import.obj";
+  const std::string ply = "bench_import.ply";
+  for (int n : { 4, 8 })
+  {
+    // copies placed same as TeapotScene::grid_objects()
+    eh::TriangleMesh source;
+    for (int i = 0; i < n; ++i)
+    {
+      for (int j = 0; j < n; ++j)
+      {
+        const vec3 offset(0.2f + 7.0f * (i - n / 2), -2.0f, -10.0f - 7.0f * j);
+        const eh::TriangleMesh::index_type base = source.positions.size();
+        for (std::size_t v = 0; v < teapot.positions.size(); ++v)
+        {
+          source.positions.push_back(teapot.positions[v] + offset);
+          source.normals.push_back(teapot.normals[v]);
+        }
+        for (auto f : teapot.faces)
+        {
+          for (auto& v : f.v)
+          {
+            v += base;
+          }
+          source.faces.push_back(f);
+        }
+      }
+    }
+    source.build();
+
+    std::vector<eh::Triangle> triangles;
+    triangles.reserve(source.faces.size());
+    for (auto const& f : source.faces)
+    {
+      triangles.emplace_back(
+          source.positions[f.v[0]], source.positions[f.v[1]],
+          source.positions[f.v[2]], source.normals[f.v[0]],
+          source.normals[f.v[1]], source.normals[f.v[2]]);
+    }
+    eh::write_stl(stl, triangles);
+    triangles.clear();
+    triangles.shrink_to_fit();
+    eh::write_obj(obj, source);
+    eh::write_ply(ply, source);
+
+    eh::TriangleMesh from_stl, from_obj, from_ply;
+    const float stl_ms = measure(
+        [&]() { eh::load_stl_mesh(stl, from_stl); });
+    const float obj_ms = measure([&]() { eh::load_obj(obj, from_obj); });
+    const float ply_ms = measure([&]() { eh::load_ply(ply, from_ply); });
+
+    // same hits from every mesh
+    eh::World world;
+    world.build({ { &scene.floor1, &scene.material },
+                  { &scene.floor2, &scene.material },
+                  { &source, &scene.material } });
+    const auto rays = make_workload(world, 128, 128);
+    int mismatches[3] = { 0, 0, 0 };
+    eh::TriangleMesh const* loaded[3] = { &from_stl, &from_obj, &from_ply };
+    for (auto const& r : rays)
+    {
+      const eh::RayHit a = source.raycast(r);
+      for (int k = 0; k < 3; ++k)
+      {
+        const eh::RayHit b = loaded[k]->raycast(r);
+        if ((a.surface == nullptr) != (b.surface == nullptr)
+            || (a.surface && a.t != b.t))
+        {
+          ++mismatches[k];
+        }
+      }
+    }
+
+    const auto mb = [](std::string const& filename)
+    {
+      return eh::FileStamp::of(filename).size / 1.0e6f;
+    };
+    std::cout << n * n << " copies, " << source.faces.size()
+              << " triangles, " << source.positions.size() << " vertices:\n";
+    std::cout << "  STL + weld:          " << mb(stl) << " MB, " << stl_ms
+              << " ms, " << from_stl.positions.size() << " vertices, "
+              << mismatches[0] << " mismatches\n";
+    std::cout << "  OBJ:                 " << mb(obj) << " MB, " << obj_ms
+              << " ms, " << from_obj.positions.size() << " vertices, "
+              << mismatches[1] << " mismatches\n";
+    std::cout << "  PLY:                 " << mb(ply) << " MB, " << ply_ms
+              << " ms, " << from_ply.positions.size() << " vertices, "
+              << mismatches[2] << " mismatches\n";
+  }
+  std::remove(stl.c_str());
+  std::remove(obj.c_str());
+  std::remove(ply.c_str());
+  std::cout << "\n";
+}
+
+
+// in-memory mesh vs. PagedMesh with shrinking cluster budget
+void bench_paging(TeapotScene& scene)
+{
+  const int n = 8;
+  const auto teapot = eh::load_stl(TEAPOT_PATH, true);
+  std::vector<eh::Triangle> soup;
+  soup.reserve(teapot.size() * n * n);
+  for (int i = 0; i < n; ++i)
+  {
+    for (int j = 0; j < n; ++j)
+    {
+      const vec3 offset(0.2f + 7.0f * (i - n / 2), -2.0f, -10.0f - 7.0f * j);
+      for (auto t : teapot)
+      {
+        t.p0 += offset;
+        t.p1 += offset;
+        t.p2 += offset;
+        soup.push_back(t);
+      }
+    }
+  }
+  eh::TriangleMesh mesh(soup);
+  soup.clear();
+  soup.shrink_to_fit();
+
+  const std::string filename = "bench_paging.paged";
+  eh::PagedMesh::write(filename, mesh);
+  eh::PagedMesh paged;
+  paged.open(filename);
+  std::cout << "[paging] " << n << "x" << n << " teapots, " << paged.size()
+            << " triangles, " << paged.cluster_count() << " clusters, "
+            << paged.cluster_bytes() / 1024 << " KiB of clusters, "
+            << mesh_bytes(mesh) / 1024 << " KiB in memory\n";
+
+  eh::World mesh_world, paged_world;
+  mesh_world.build({ { &scene.floor1, &scene.material },
+                     { &scene.floor2, &scene.material },
+                     { &mesh, &scene.material } });
+  paged_world.build({ { &scene.floor1, &scene.material },
+                      { &scene.floor2, &scene.material },
+                      { &paged, &scene.material } });
+  const auto rays = make_workload(mesh_world, 256, 256);
+
+  int mismatches = 0;
+  for (auto const& r : rays)
+  {
+    const eh::RayHit a = mesh.raycast(r);
+    const eh::RayHit b = paged.raycast(r);
+    if ((a.surface == nullptr) != (b.surface == nullptr)
+        || (a.surface && a.t != b.t))
+    {
+      ++mismatches;
+    }
+  }
+  std::cout << rays.size() << " rays, " << mismatches << " mismatches\n";
+  std::cout << "in memory:\n";
+  const float mesh_rays = trace_workload(mesh_world, rays);
+
+  for (float fraction : { 1.0f, 0.25f, 0.05f, 0.01f })
+  {
+    paged.set_budget(paged.cluster_bytes() * fraction);
+    paged.drop_cache();
+    paged.reset_stats();
+    std::cout << "budget " << fraction * 100 << "%, "
+              << paged.budget_bytes() / 1024 << " KiB:\n";
+    const float paged_rays = trace_workload(paged_world, rays);
+    const auto stats = paged.stats();
+    std::cout << "  hits " << stats.hits << ", faults " << stats.faults
+              << ", hit rate "
+              << 100.0 * stats.hits / std::max<std::uint64_t>(
+                     1, stats.hits + stats.faults)
+              << "%, cached " << paged.cached_bytes() / 1024 << " KiB, "
+              << paged_rays / mesh_rays << "x of in memory\n";
+  }
+  std::remove(filename.c_str());
+  std::cout << "\n";
+}
+
+
+// recursive get_color() vs. iterative trace_path() on TeapotDemo;
+// per-pixel variance of one pass times its cost, as time to equal noise
+void bench_pathtrace(TeapotScene&)
+{
+  const int w = 64, h = 64, passes = 32;
+  TeapotDemo world(w, h, std::thread::hardware_concurrency());
+  world.freeze(eh::World::Accelerator::SIMDRTree);
+  // fewer diffuse rays, so that the recursive one finishes in seconds
+  world.reflections.diffusive.sample_count = 3;
+  world.reflections.floor_diffuse.sample_count = 3;
+  std::cout << "[pathtrace] " << w << "x" << h << " TeapotDemo, "
+            << world.shoot_count << " rays/pixel, " << passes << " passes\n";
+
+  struct result_t
+  {
+    float ms_per_pass;
+    // mean over pixels of variance of one pass
+    float variance;
+    float mean;
+  };
+  const auto run = [&]() -> result_t
+  {
+    std::vector<double> sum(w * h, 0.0), sum2(w * h, 0.0);
+    float ms = 0;
+    for (int p = 0; p < passes; ++p)
+    {
+      // framebuffer holds this pass only
+      world.clear_framebuffer();
+      ms += measure(
+          [&]()
+          {
+            for (int i = 0; i < w * h; ++i)
+            {
+              world.render_pixel(i % w, i / w, 0);
+            }
+          });
+      for (int i = 0; i < w * h; ++i)
+      {
+        const double y = world.framebuffer[i].mean();
+        sum[i] += y;
+        sum2[i] += y * y;
+      }
+    }
+    result_t ret { ms / passes, 0, 0 };
+    for (int i = 0; i < w * h; ++i)
+    {
+      const double mean = sum[i] / passes;
+      ret.mean += mean / (w * h);
+      ret.variance
+          += (sum2[i] - passes * mean * mean) / (passes - 1) / (w * h);
+    }
+    return ret;
+  };
+  const auto print = [](char const* name, result_t const& r)
+  {
+    std::cout << name << r.ms_per_pass << " ms/pass, mean " << r.mean
+              << ", variance " << r.variance << ", variance x time "
+              << r.variance * r.ms_per_pass << "\n";
+  };
+
+  world.iterative_paths = false;
+  const result_t recursive = run();
+  print("recursive, max_bounce 3:  ", recursive);
+  for (int depth : { 1, 3, 5 })
+  {
+    world.iterative_paths = true;
+    world.roulette_depth = depth;
+    const result_t iterative = run();
+    std::cout << "iterative, roulette at " << depth << ": ";
+    print("", iterative);
+    std::cout << "  time to equal noise, recursive / iterative: "
+              << recursive.variance * recursive.ms_per_pass
+                     / (iterative.variance * iterative.ms_per_pass)
+              << "x\n";
+  }
+  world.iterative_paths = false;
+  std::cout << "\n";
+}
+
+}
+
+int main(int argc, char** argv)
+{
+  const std::string which = argc > 1 ? argv[1] : "all";
+
+  TeapotScene scene;
+  if (which == "all" || which == "build")
+  {
+    bench_build(scene);
+  }
+  if (which == "all" || which == "bvh")
+  {
+    bench_bvh(scene);
+  }
+  if (which == "all" || which == "flat")
+  {
+    bench_flat(scene);
+  }
+  if (which == "all" || which == "order")
+  {
+    bench_order(scene);
+  }
+  if (which == "all" || which == "simd")
+  {
+    bench_simd(scene);
+  }
+  if (which == "all" || which == "quantize")
+  {
+    bench_quantize(scene);
+  }
+  if (which == "all" || which == "instance")
+  {
+    bench_instance(scene);
+  }
+  if (which == "all" || which == "refit")
+  {
+    bench_refit(scene);
+  }
+  if (which == "all" || which == "unbounded")
+  {
+    bench_unbounded(scene);
+  }
+  if (which == "all" || which == "mesh")
+  {
+    bench_mesh(scene);
+  }
+  if (which == "all" || which == "intersect")
+  {
+    bench_intersect(scene);
+  }
+  if (which == "all" || which == "occluded")
+  {
+    bench_occluded(scene);
+  }
+  if (which == "all" || which == "packet")
+  {
+    bench_packet(scene);
+  }
+  if (which == "all" || which == "wavefront")
+  {
+    bench_wavefront(scene);
+  }
+  if (which == "all" || which == "coherence")
+  {
+    bench_coherence(scene);
+  }
+  if (which == "all" || which == "layout")
+  {
+    bench_layout(scene);
+  }
+  if (which == "all" || which == "arena")
+  {
+    bench_arena(scene);
+  }
+  if (which == "all" || which == "parallel")
+  {
+    bench_parallel(scene);
+  }
+  if (which == "all" || which == "cache")
+  {
+    bench_cache(scene);
+  }
+  if (which == "all" || which == "loader")
+  {
+    bench_loader(scene);
+  }
+  if (which == "all" || which == "ingest")
+  {
+    bench_ingest(scene);
+  }
+  if (which == "all" || which == "ascii")
+  {
+    bench_ascii(scene);
+  }
+  if (which == "all" || which == "import")
+  {
+    bench_import(scene);
+  }
+  if (which == "all" || which == "paging")
+  {
+    bench_paging(scene);
+  }
+  if (which == "all" || which == "pathtrace")
+  {
+    bench_pathtrace(scene);
+  }
+  return 0;
+}
@@ -0,0 +1,701 @@
+#include "mesh_loader.hpp"
+#include "parse_util.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace eh
+{
+
+namespace
+{
+/*
+  file read front to back through one fixed size buffer
+
+  memory stays at CHUNK_BYTES whatever the file size;
+  the buffer grows only for a single line or record longer than that.
+*/
+class ChunkReader
+{
+protected:
+  std::ifstream _ifs;
+  std::vector<char> _buffer;
+  // unread bytes are [_begin, _end) of _buffer
+  std::size_t _begin = 0;
+  std::size_t _end = 0;
+  bool _eof = false;
+
+public:
+  constexpr static std::size_t CHUNK_BYTES = std::size_t(1) << 20;
+
+  explicit ChunkReader(std::string const& filename)
+      : _ifs(filename, std::ios::binary)
+      , _buffer(CHUNK_BYTES)
+  {
+    if (!_ifs)
+    {
+      throw std::runtime_error("cannot open file: " + filename);
+    }
+  }
+
+  // make at least n unread bytes ready; false if the file ends before
+  bool fill(std::size_t n)
+  {
+    if (_end - _begin >= n)
+    {
+      return true;
+    }
+    // move unread bytes to the front, then read after them
+    std::memmove(_buffer.data(), _buffer.data() + _begin, _end - _begin);
+    _end -= _begin;
+    _begin = 0;
+    if (_buffer.size() < n)
+    {
+      _buffer.resize(std::max(n, _buffer.size() * 2));
+    }
+    while (_end < n && _eof == false)
+    {
+      _ifs.read(_buffer.data() + _end, _buffer.size() - _end);
+      _end += _ifs.gcount();
+      if (_ifs.gcount() == 0)
+      {
+        _eof = true;
+      }
+    }
+    return _end - _begin >= n;
+  }
+
+  // n bytes, valid until next call; fill(n) must have returned true
+  char const* take(std::size_t n)
+  {
+    char const* ret = _buffer.data() + _begin;
+    _begin += n;
+    return ret;
+  }
+
+  // next line, without '\n'; false at end of file
+  bool line(char const*& first, char const*& last)
+  {
+    std::size_t scanned = 0;
+    while (true)
+    {
+      char const* p = _buffer.data() + _begin;
+      char const* eol = static_cast<char const*>(
+          std::memchr(p + scanned, '\n', _end - _begin - scanned));
+      if (eol)
+      {
+        first = p;
+        last = eol;
+        _begin += eol - p + 1;
+        return true;
+      }
+      scanned = _end - _begin;
+      if (fill(scanned + 1) == false)
+      {
+        // last line without '\n'
+        if (_end == _begin)
+        {
+          return false;
+        }
+        first = _buffer.data() + _begin;
+        last = _buffer.data() + _end;
+        _begin = _end;
+        return true;
+      }
+    }
+  }
+};
+
+using parse::is_space;
+using parse::parse_number;
+using parse::skip_space;
+using parse::starts_with;
+
+constexpr TriangleMesh::index_type NONE
+    = std::numeric_limits<TriangleMesh::index_type>::max();
+
+// normals of vertices marked by `missing`, averaged from faces around them,
+// weighted by area
+void fill_missing_normals(TriangleMesh& mesh, std::vector<bool> const& missing)
+{
+  std::vector<vec3> sums(mesh.positions.size(), vec3::Zero());
+  for (auto const& f : mesh.faces)
+  {
+    vec3 const& p0 = mesh.positions[f.v[0]];
+    const vec3 n
+        = (mesh.positions[f.v[1]] - p0).cross(mesh.positions[f.v[2]] - p0);
+    for (int k = 0; k < 3; ++k)
+    {
+      sums[f.v[k]] += n;
+    }
+  }
+  for (std::size_t v = 0; v < mesh.positions.size(); ++v)
+  {
+    if (missing[v])
+    {
+      mesh.normals[v] = sums[v].normalized();
+    }
+  }
+}
+}
+
+// streamed line by line; only v and vn values, and one mesh vertex per
+// distinct (v, vn) pair used by faces, are kept in memory
+void load_obj(std::string const& filename, TriangleMesh& mesh)
+{
+  using index_type = TriangleMesh::index_type;
+
+  std::vector<vec3> obj_positions;
+  std::vector<vec3> obj_normals;
+
+  // mesh vertex as (v, vn) of OBJ, NONE if no vn
+  std::vector<std::pair<index_type, index_type>> vertices;
+  // first mesh vertex of each v, and next mesh vertex with the same v
+  std::vector<index_type> first_vertex;
+  std::vector<index_type> next_vertex;
+  const auto vertex_of = [&](index_type v, index_type vn)
+  {
+    if (first_vertex.size() <= v)
+    {
+      first_vertex.resize(v + 1, NONE);
+    }
+    for (index_type i = first_vertex[v]; i != NONE; i = next_vertex[i])
+    {
+      if (vertices[i].second == vn)
+      {
+        return i;
+      }
+    }
+    const index_type i = vertices.size();
+    vertices.push_back({ v, vn });
+    next_vertex.push_back(first_vertex[v]);
+    first_vertex[v] = i;
+    return i;
+  };
+  // 1-based, or negative from the end of elements read so far
+  const auto resolve = [](long long index, std::size_t count)
+  {
+    const long long ret = index < 0 ? (long long)count + index : index - 1;
+    if (ret < 0)
+    {
+      throw std::runtime_error("OBJ: invalid index");
+    }
+    return static_cast<index_type>(ret);
+  };
+
+  mesh.faces.clear();
+  mesh.material_ids.clear();
+  mesh.materials.clear();
+  std::vector<index_type> polygon;
+  ChunkReader reader(filename);
+  char const* first;
+  char const* last;
+  while (reader.line(first, last))
+  {
+    char const* p = skip_space(first, last);
+    if (starts_with(p, last, "v"))
+    {
+      vec3 v;
+      p = parse_number(p + 1, last, v.x());
+      p = parse_number(p, last, v.y());
+      parse_number(p, last, v.z());
+      obj_positions.push_back(v);
+    }
+    else if (starts_with(p, last, "vn"))
+    {
+      vec3 n;
+      p = parse_number(p + 2, last, n.x());
+      p = parse_number(p, last, n.y());
+      parse_number(p, last, n.z());
+      obj_normals.push_back(n);
+    }
+    else if (starts_with(p, last, "f"))
+    {
+      // v, v/vt, v//vn or v/vt/vn
+      polygon.clear();
+      for (p = skip_space(p + 1, last); p < last; p = skip_space(p, last))
+      {
+        long long v, vn = 0;
+        p = parse_number(p, last, v);
+        if (p < last && *p == '/')
+        {
+          ++p;
+          if (p < last && *p != '/')
+          {
+            long long vt;
+            p = parse_number(p, last, vt);
+          }
+          if (p < last && *p == '/')
+          {
+            p = parse_number(p + 1, last, vn);
+          }
+        }
+        polygon.push_back(vertex_of(
+            resolve(v, obj_positions.size()),
+            vn == 0 ? NONE : resolve(vn, obj_normals.size())));
+      }
+      if (polygon.size() < 3)
+      {
+        throw std::runtime_error("OBJ: face with less than 3 vertices");
+      }
+      for (std::size_t k = 1; k + 1 < polygon.size(); ++k)
+      {
+        mesh.faces.push_back({ { polygon[0], polygon[k], polygon[k + 1] } });
+      }
+    }
+    // vt, o, g, s, usemtl, comments, ... are skipped
+  }
+
+  mesh.positions.resize(vertices.size());
+  mesh.normals.resize(vertices.size());
+  std::vector<bool> missing(vertices.size(), false);
+  bool any_missing = false;
+  for (std::size_t i = 0; i < vertices.size(); ++i)
+  {
+    if (vertices[i].first >= obj_positions.size()
+        || (vertices[i].second != NONE
+            && vertices[i].second >= obj_normals.size()))
+    {
+      throw std::runtime_error("OBJ: index out of range");
+    }
+    mesh.positions[i] = obj_positions[vertices[i].first];
+    if (vertices[i].second == NONE)
+    {
+      missing[i] = any_missing = true;
+    }
+    else
+    {
+      mesh.normals[i] = obj_normals[vertices[i].second].normalized();
+    }
+  }
+  if (any_missing)
+  {
+    fill_missing_normals(mesh, missing);
+  }
+  std::cout << "Load OBJ: " << mesh.faces.size() << " triangles, "
+            << mesh.positions.size() << " vertices" << std::endl;
+  mesh.build();
+}
+
+namespace
+{
+enum class ply_type
+{
+  INT8,
+  UINT8,
+  INT16,
+  UINT16,
+  INT32,
+  UINT32,
+  FLOAT32,
+  FLOAT64,
+};
+
+ply_type ply_type_of(std::string const& name)
+{
+  if (name == "char" || name == "int8")
+  {
+    return ply_type::INT8;
+  }
+  if (name == "uchar" || name == "uint8")
+  {
+    return ply_type::UINT8;
+  }
+  if (name == "short" || name == "int16")
+  {
+    return ply_type::INT16;
+  }
+  if (name == "ushort" || name == "uint16")
+  {
+    return ply_type::UINT16;
+  }
+  if (name == "int" || name == "int32")
+  {
+    return ply_type::INT32;
+  }
+  if (name == "uint" || name == "uint32")
+  {
+    return ply_type::UINT32;
+  }
+  if (name == "float" || name == "float32")
+  {
+    return ply_type::FLOAT32;
+  }
+  if (name == "double" || name == "float64")
+  {
+    return ply_type::FLOAT64;
+  }
+  throw std::runtime_error("PLY: unknown property type " + name);
+}
+
+std::size_t ply_size(ply_type type)
+{
+  switch (type)
+  {
+  case ply_type::INT8:
+  case ply_type::UINT8:
+    return 1;
+  case ply_type::INT16:
+  case ply_type::UINT16:
+    return 2;
+  case ply_type::INT32:
+  case ply_type::UINT32:
+  case ply_type::FLOAT32:
+    return 4;
+  case ply_type::FLOAT64:
+    return 8;
+  }
+  return 0;
+}
+
+// one value at p, byte order swapped if `swap`
+template <typename T>
+T ply_read(char const* p, ply_type type, bool swap)
+{
+  char bytes[8];
+  const std::size_t size = ply_size(type);
+  std::memcpy(bytes, p, size);
+  if (swap)
+  {
+    std::reverse(bytes, bytes + size);
+  }
+  const auto as = [&](auto value)
+  {
+    std::memcpy(&value, bytes, sizeof(value));
+    return static_cast<T>(value);
+  };
+  switch (type)
+  {
+  case ply_type::INT8:
+    return as(std::int8_t());
+  case ply_type::UINT8:
+    return as(std::uint8_t());
+  case ply_type::INT16:
+    return as(std::int16_t());
+  case ply_type::UINT16:
+    return as(std::uint16_t());
+  case ply_type::INT32:
+    return as(std::int32_t());
+  case ply_type::UINT32:
+    return as(std::uint32_t());
+  case ply_type::FLOAT32:
+    return as(float());
+  case ply_type::FLOAT64:
+    return as(double());
+  }
+  return T();
+}
+
+struct ply_property_t
+{
+  std::string name;
+  ply_type type;
+  // list of `type`, prefixed by its size in `count_type`
+  bool list = false;
+  ply_type count_type;
+};
+struct ply_element_t
+{
+  std::string name;
+  std::uint64_t count = 0;
+  std::vector<ply_property_t> properties;
+};
+
+bool host_is_little_endian()
+{
+  const std::uint16_t one = 1;
+  char c;
+  std::memcpy(&c, &one, 1);
+  return c == 1;
+}
+}
+
+// records are read one by one through the chunk buffer;
+// vertices and faces go straight into the mesh arrays
+void load_ply(std::string const& filename, TriangleMesh& mesh)
+{
+  using index_type = TriangleMesh::index_type;
+
+  ChunkReader reader(filename);
+  char const* first;
+  char const* last;
+  const auto word = [](char const*& p, char const* last)
+  {
+    char const* begin = skip_space(p, last);
+    p = begin;
+    while (p < last && is_space(*p) == false)
+    {
+      ++p;
+    }
+    return std::string(begin, p);
+  };
+
+  // header
+  if (reader.line(first, last) == false || word(first, last) != "ply")
+  {
+    throw std::runtime_error("PLY: not a PLY file: " + filename);
+  }
+  bool swap = false;
+  std::vector<ply_element_t> elements;
+  while (true)
+  {
+    if (reader.line(first, last) == false)
+    {
+      throw std::runtime_error("PLY: header without end_header");
+    }
+    const std::string keyword = word(first, last);
+    if (keyword == "end_header")
+    {
+      break;
+    }
+    if (keyword == "format")
+    {
+      const std::string format = word(first, last);
+      if (format == "binary_little_endian")
+      {
+        swap = host_is_little_endian() == false;
+      }
+      else if (format == "binary_big_endian")
+      {
+        swap = host_is_little_endian();
+      }
+      else
+      {
+        throw std::runtime_error("PLY: only binary format is supported");
+      }
+    }
+    else if (keyword == "element")
+    {
+      ply_element_t element;
+      element.name = word(first, last);
+      parse_number(first, last, element.count);
+      elements.push_back(element);
+    }
+    else if (keyword == "property")
+    {
+      if (elements.empty())
+      {
+        throw std::runtime_error("PLY: property before element");
+      }
+      ply_property_t property;
+      std::string type = word(first, last);
+      if (type == "list")
+      {
+        property.list = true;
+        property.count_type = ply_type_of(word(first, last));
+        type = word(first, last);
+      }
+      property.type = ply_type_of(type);
+      property.name = word(first, last);
+      elements.back().properties.push_back(property);
+    }
+    // comment, obj_info are skipped
+  }
+
+  mesh.positions.clear();
+  mesh.normals.clear();
+  mesh.faces.clear();
+  mesh.material_ids.clear();
+  mesh.materials.clear();
+  bool has_normal = false;
+  for (ply_element_t const& element : elements)
+  {
+    // offsets of fixed size properties in a record; -1 if it has a list
+    std::vector<long long> offsets;
+    long long record_bytes = 0;
+    for (auto const& property : element.properties)
+    {
+      offsets.push_back(record_bytes);
+      if (record_bytes >= 0)
+      {
+        record_bytes
+            = property.list ? -1 : record_bytes + ply_size(property.type);
+      }
+    }
+    // index of fixed size property `name`, -1 if none
+    const auto index_of = [&](char const* name) -> long long
+    {
+      for (std::size_t i = 0; i < element.properties.size(); ++i)
+      {
+        if (element.properties[i].name == name
+            && element.properties[i].list == false)
+        {
+          return i;
+        }
+      }
+      return -1;
+    };
+
+    if (element.name == "vertex")
+    {
+      if (record_bytes < 0)
+      {
+        throw std::runtime_error("PLY: list property in vertex");
+      }
+      const long long xyz[3]
+          = { index_of("x"), index_of("y"), index_of("z") };
+      const long long nxyz[3]
+          = { index_of("nx"), index_of("ny"), index_of("nz") };
+      if (xyz[0] < 0 || xyz[1] < 0 || xyz[2] < 0)
+      {
+        throw std::runtime_error("PLY: vertex without x, y, z");
+      }
+      has_normal = nxyz[0] >= 0 && nxyz[1] >= 0 && nxyz[2] >= 0;
+      mesh.positions.resize(element.count);
+      mesh.normals.resize(element.count, vec3::Zero());
+      for (std::uint64_t i = 0; i < element.count; ++i)
+      {
+        if (reader.fill(record_bytes) == false)
+        {
+          throw std::runtime_error("PLY: file is truncated");
+        }
+        char const* record = reader.take(record_bytes);
+        for (int a = 0; a < 3; ++a)
+        {
+          auto const& x = element.properties[xyz[a]];
+          mesh.positions[i][a]
+              = ply_read<float>(record + offsets[xyz[a]], x.type, swap);
+          if (has_normal)
+          {
+            auto const& n = element.properties[nxyz[a]];
+            mesh.normals[i][a]
+                = ply_read<float>(record + offsets[nxyz[a]], n.type, swap);
+          }
+        }
+      }
+      continue;
+    }
+
+    // faces, and any other element read property by property
+    const bool is_face = element.name == "face";
+    if (is_face)
+    {
+      mesh.faces.reserve(element.count);
+    }
+    std::vector<index_type> polygon;
+    for (std::uint64_t i = 0; i < element.count; ++i)
+    {
+      for (auto const& property : element.properties)
+      {
+        std::size_t count = 1;
+        if (property.list)
+        {
+          const std::size_t count_bytes = ply_size(property.count_type);
+          if (reader.fill(count_bytes) == false)
+          {
+            throw std::runtime_error("PLY: file is truncated");
+          }
+          count = ply_read<std::size_t>(reader.take(count_bytes),
+                                        property.count_type, swap);
+        }
+        const std::size_t size = ply_size(property.type);
+        if (reader.fill(count * size) == false)
+        {
+          throw std::runtime_error("PLY: file is truncated");
+        }
+        char const* values = reader.take(count * size);
+        if (is_face && property.list
+            && (property.name == "vertex_indices"
+                || property.name == "vertex_index"))
+        {
+          if (count < 3)
+          {
+            throw std::runtime_error("PLY: face with less than 3 vertices");
+          }
+          polygon.resize(count);
+          for (std::size_t k = 0; k < count; ++k)
+          {
+            polygon[k]
+                = ply_read<index_type>(values + k * size, property.type, swap);
+            if (polygon[k] >= mesh.positions.size())
+            {
+              throw std::runtime_error("PLY: index out of range");
+            }
+          }
+          for (std::size_t k = 1; k + 1 < count; ++k)
+          {
+            mesh.faces.push_back(
+                { { polygon[0], polygon[k], polygon[k + 1] } });
+          }
+        }
+      }
+    }
+  }
+
+  if (has_normal)
+  {
+    for (auto& n : mesh.normals)
+    {
+      n.normalize();
+    }
+  }
+  else
+  {
+    fill_missing_normals(mesh,
+                         std::vector<bool>(mesh.positions.size(), true));
+  }
+  std::cout << "Load PLY: " << mesh.faces.size() << " triangles, "
+            << mesh.positions.size() << " vertices" << std::endl;
+  mesh.build();
+}
+
+void write_obj(std::string const& filename, TriangleMesh const& mesh)
+{
+  std::ofstream ofs(filename);
+  // enough digits to read back the same float
+  ofs << std::setprecision(9);
+  for (auto const& p : mesh.positions)
+  {
+    ofs << "v " << p.x() << ' ' << p.y() << ' ' << p.z() << '\n';
+  }
+  for (auto const& n : mesh.normals)
+  {
+    ofs << "vn " << n.x() << ' ' << n.y() << ' ' << n.z() << '\n';
+  }
+  for (auto const& f : mesh.faces)
+  {
+    ofs << 'f';
+    for (int k = 0; k < 3; ++k)
+    {
+      ofs << ' ' << f.v[k] + 1 << "//" << f.v[k] + 1;
+    }
+    ofs << '\n';
+  }
+}
+
+void write_ply(std::string const& filename, TriangleMesh const& mesh)
+{
+  std::ofstream ofs(filename, std::ios::binary);
+  ofs << "ply\n"
+      << "format "
+      << (host_is_little_endian() ? "binary_little_endian"
+                                  : "binary_big_endian")
+      << " 1.0\n"
+      << "element vertex " << mesh.positions.size() << '\n'
+      << "property float x\nproperty float y\nproperty float z\n"
+      << "property float nx\nproperty float ny\nproperty float nz\n"
+      << "element face " << mesh.faces.size() << '\n'
+      << "property list uchar uint vertex_indices\n"
+      << "end_header\n";
+  for (std::size_t i = 0; i < mesh.positions.size(); ++i)
+  {
+    ofs.write((char const*)mesh.positions[i].data(), 12);
+    ofs.write((char const*)mesh.normals[i].data(), 12);
+  }
+  for (auto const& f : mesh.faces)
+  {
+    const std::uint8_t count = 3;
+    ofs.write((char const*)&count, 1);
+    ofs.write((char const*)f.v, 12);
+  }
+}
+
+}
@@ -0,0 +1,19 @@
+#pragma once
+
+#include <mesh.hpp>
+#include <string>
+
+namespace eh
+{
+// indexed mesh from Wavefront OBJ; v, vn and f lines are read,
+// polygons are split into triangle fans.
+// vertices without vn get normals averaged from faces around them
+void load_obj(std::string const& filename, TriangleMesh& mesh);
+// indexed mesh from binary PLY, little or big endian;
+// vertex x, y, z and optional nx, ny, nz, and face vertex_indices
+void load_ply(std::string const& filename, TriangleMesh& mesh);
+
+void write_obj(std::string const& filename, TriangleMesh const& mesh);
+// binary PLY in host byte order
+void write_ply(std::string const& filename, TriangleMesh const& mesh);
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <charconv>
+#include <cstring>
+#include <stdexcept>
+#include <system_error>
+
+namespace eh
+{
+// helpers shared by the text loaders; they parse [first, last) in place
+namespace parse
+{
+inline bool is_space(char c)
+{
+  return c == ' ' || c == '\t' || c == '\r' || c == '\n' || c == '\f'
+         || c == '\v';
+}
+inline char const* skip_space(char const* p, char const* last)
+{
+  while (p < last && is_space(*p))
+  {
+    ++p;
+  }
+  return p;
+}
+
+// [first, last) starts with `keyword` followed by space or end
+inline bool
+starts_with(char const* first, char const* last, char const* keyword)
+{
+  const std::size_t n = std::strlen(keyword);
+  return std::size_t(last - first) >= n && std::memcmp(first, keyword, n) == 0
+         && (std::size_t(last - first) == n || is_space(first[n]));
+}
+
+// number after spaces; returns the end of it
+// throws std::runtime_error with `error` if there is none
+template <typename T>
+char const* parse_number(char const* p,
+                         char const* last,
+                         T& out,
+                         char const* error = "invalid number")
+{
+  p = skip_space(p, last);
+  // from_chars does not accept leading '+'
+  if (p < last && *p == '+')
+  {
+    ++p;
+  }
+  const auto res = std::from_chars(p, last, out);
+  if (res.ec != std::errc())
+  {
+    throw std::runtime_error(error);
+  }
+  return res.ptr;
+}
+}
+}
@@ -1,118 +1,524 @@
 #include "stl_loader.hpp"
 #include "geometry.hpp"
+#include "mapped_file.hpp"
+#include "mesh.hpp"
+#include "parallel.hpp"
+#include "parse_util.hpp"
 
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstring>
+#include <exception>
 #include <fstream>
 #include <iostream>
+#include <limits>
+#include <map>
 #include <stdexcept>
+#include <thread>
+#include <utility>
+#include <unordered_map>
 
 namespace eh
 {
 
-std::vector<Triangle> load_stl_ascii(std::ifstream& ifs)
+namespace
 {
-  throw std::runtime_error("ASCII STL is not supported yet");
-  return {};
+// binary STL: 80 bytes header, triangle count, then 50 bytes per triangle;
+// normal, 3 vertices and 2 bytes attribute, packed without padding
+constexpr std::size_t STL_HEADER_BYTES = 84;
+constexpr std::size_t STL_RECORD_BYTES = 50;
+
+// "solid" after leading spaces
+bool starts_with_solid(MappedFile const& file)
+{
+  char const* last = file.data() + file.size();
+  char const* p = parse::skip_space(file.data(), last);
+  return last - p >= 5 && std::memcmp(p, "solid", 5) == 0;
 }
-std::vector<Triangle> load_stl_binary(std::ifstream& ifs, bool vertex_normal)
+
+// binary if the file holds all records the header declares, trailing bytes
+// are ignored; some binary files also start with "solid".
+// a shorter file is ASCII if it starts with "solid", else truncated binary
+bool is_binary_stl(MappedFile const& file, uint32_t& triangle_count)
 {
-  ifs.seekg(80, std::ios::beg);
-  uint32_t triangle_count;
-  ifs.read((char*)&triangle_count, 4);
-  std::vector<Triangle> triangles;
-  triangles.resize(triangle_count);
-  std::cout << "Load STL: " << triangle_count << " triangles" << std::endl;
-  for (unsigned int i = 0; i < triangle_count; ++i)
+  triangle_count = 0;
+  if (file.size() >= STL_HEADER_BYTES)
   {
-    vec3 normal;
-    ifs.read((char*)&normal, 12);
-    ifs.read((char*)triangles[i].p0.data(), 12);
-    ifs.read((char*)triangles[i].p1.data(), 12);
-    ifs.read((char*)triangles[i].p2.data(), 12);
-
-    vec3 a = triangles[i].p1 - triangles[i].p0;
-    vec3 b = triangles[i].p2 - triangles[i].p0;
-    vec3 c = a.cross(b);
-    c.normalize();
-    triangles[i].n0 = triangles[i].n1 = triangles[i].n2 = c;
-    ifs.seekg(2, std::ios::cur);
+    std::memcpy(&triangle_count, file.data() + 80, 4);
+    if (file.size() >= STL_HEADER_BYTES
+                           + std::size_t(triangle_count) * STL_RECORD_BYTES)
+    {
+      return true;
+    }
   }
+  if (starts_with_solid(file))
+  {
+    return false;
+  }
+  throw std::runtime_error("binary STL: file is truncated");
+}
+
+// records are not aligned to float
+vec3 read_vec3(char const* p)
+{
+  vec3 ret;
+  std::memcpy(ret.data(), p, 12);
+  return ret;
+}
 
-  if (vertex_normal == false)
+MappedFile open_stl(std::string const& filename)
+{
+  MappedFile file(filename);
+  if (file.is_open() == false)
   {
-    return triangles;
+    throw std::runtime_error("cannot open STL file: " + filename);
   }
+  file.will_read_sequential();
+  return file;
+}
+}
+
+namespace
+{
+using parse::is_space;
+using parse::parse_number;
+using parse::starts_with;
 
-  // for vertex-normals
-  std::vector<std::pair<vec3, vec3>> vertex_normals;
-  vertex_normals.reserve(triangles.size() * 3);
-  for (auto& t : triangles)
+// start of the first line at or after `p` whose first word is "facet";
+// same `p` gives same line, so chunks split by this never overlap
+char const* next_facet(char const* p, char const* first, char const* last)
+{
+  // back to the start of the line `p` is in
+  while (p > first && p[-1] != '\n')
   {
-    vertex_normals.push_back(std::make_pair(t.p0, t.n0));
-    vertex_normals.push_back(std::make_pair(t.p1, t.n1));
-    vertex_normals.push_back(std::make_pair(t.p2, t.n2));
+    --p;
   }
+  while (p < last)
+  {
+    char const* line = p;
+    while (p < last && (*p == ' ' || *p == '\t'))
+    {
+      ++p;
+    }
+    if (starts_with(p, last, "facet"))
+    {
+      return line;
+    }
+    p = static_cast<char const*>(std::memchr(p, '\n', last - p));
+    if (p == nullptr)
+    {
+      return last;
+    }
+    ++p;
+  }
+  return last;
+}
 
-  std::vector<Triangle> new_triangles = triangles;
-  for (int i = 0; i < new_triangles.size(); ++i)
+// facets in [first, last), appended to `out`, without normals
+void parse_stl_ascii(char const* first,
+                     char const* last,
+                     std::vector<Triangle>& out)
+{
+  vec3 v[3];
+  int vertex_count = 0;
+  char const* p = first;
+  while (p < last)
   {
-    vec3 normal = vec3::Zero();
-    int cnt = 0;
-    for (auto const& vn : vertex_normals)
+    while (p < last && is_space(*p))
+    {
+      ++p;
+    }
+    char const* eol
+        = static_cast<char const*>(std::memchr(p, '\n', last - p));
+    if (eol == nullptr)
+    {
+      eol = last;
+    }
+
+    if (starts_with(p, eol, "vertex"))
     {
-      if ((new_triangles[i].p0 - vn.first).squaredNorm() < 1e-6)
+      if (vertex_count == 3)
       {
-        normal += vn.second;
-        ++cnt;
+        throw std::runtime_error("ASCII STL: facet with more than 3 vertices");
       }
+      p += 6;
+      for (int a = 0; a < 3; ++a)
+      {
+        p = parse_number(p, eol, v[vertex_count][a],
+                         "ASCII STL: invalid vertex coordinate");
+      }
+      ++vertex_count;
     }
-    new_triangles[i].n0 = normal / cnt;
-
-    normal = vec3::Zero();
-    cnt = 0;
-    for (auto const& vn : vertex_normals)
+    else if (starts_with(p, eol, "facet"))
+    {
+      vertex_count = 0;
+    }
+    else if (starts_with(p, eol, "endfacet"))
     {
-      if ((new_triangles[i].p1 - vn.first).squaredNorm() < 1e-6)
+      if (vertex_count != 3)
       {
-        normal += vn.second;
-        ++cnt;
+        throw std::runtime_error("ASCII STL: facet without 3 vertices");
       }
+      out.emplace_back(v[0], v[1], v[2], vec3(), vec3(), vec3());
+      vertex_count = 0;
     }
-    new_triangles[i].n1 = normal / cnt;
+    // solid, outer loop, endloop, endsolid are skipped
+    p = eol;
+  }
+}
+}
 
-    normal = vec3::Zero();
-    cnt = 0;
-    for (auto const& vn : vertex_normals)
+// the file is cut at facet lines into one chunk per thread;
+// chunks are parsed in place from the mapped file, then joined in order
+std::vector<Triangle> load_stl_ascii(MappedFile const& file)
+{
+  char const* first = file.data();
+  char const* last = first + file.size();
+
+  // truncated text has no "endsolid" on its last line
+  char const* tail = last;
+  while (tail > first && is_space(tail[-1]))
+  {
+    --tail;
+  }
+  char const* tail_line = tail;
+  while (tail_line > first && tail_line[-1] != '\n')
+  {
+    --tail_line;
+  }
+  while (tail_line < tail && is_space(*tail_line))
+  {
+    ++tail_line;
+  }
+  if (starts_with_solid(file) == false
+      || starts_with(tail_line, tail, "endsolid") == false)
+  {
+    throw std::runtime_error("ASCII STL: no solid ... endsolid");
+  }
+
+  const unsigned int thread_count
+      = std::max(1u, std::thread::hardware_concurrency());
+  std::vector<std::vector<Triangle>> chunks(thread_count);
+  std::vector<std::exception_ptr> errors(thread_count);
+  parallel_chunks(
+      file.size(),
+      [&](unsigned int t, std::size_t begin, std::size_t end)
+      {
+        try
+        {
+          char const* chunk_first = next_facet(first + begin, first, last);
+          char const* chunk_last = next_facet(first + end, first, last);
+          // a facet takes 200 bytes or more
+          chunks[t].reserve((chunk_last - chunk_first) / 200);
+          parse_stl_ascii(chunk_first, chunk_last, chunks[t]);
+        }
+        catch (...)
+        {
+          errors[t] = std::current_exception();
+        }
+      },
+      thread_count);
+  for (auto const& e : errors)
+  {
+    if (e)
     {
-      if ((new_triangles[i].p2 - vn.first).squaredNorm() < 1e-6)
+      std::rethrow_exception(e);
+    }
+  }
+
+  std::vector<std::size_t> offsets(thread_count + 1, 0);
+  for (unsigned int t = 0; t < thread_count; ++t)
+  {
+    offsets[t + 1] = offsets[t] + chunks[t].size();
+  }
+  if (offsets[thread_count] == 0)
+  {
+    throw std::runtime_error("ASCII STL: no facet");
+  }
+  std::vector<Triangle> triangles(offsets[thread_count]);
+  parallel_for(
+      thread_count,
+      [&](std::size_t t)
       {
-        normal += vn.second;
-        ++cnt;
+        std::copy(chunks[t].begin(), chunks[t].end(),
+                  triangles.begin() + offsets[t]);
+      },
+      thread_count);
+  std::cout << "Load STL: " << triangles.size() << " triangles" << std::endl;
+  return triangles;
+}
+
+// records are read in place from the mapped file, on multiple threads
+std::vector<Triangle> load_stl_binary(MappedFile const& file,
+                                      uint32_t triangle_count)
+{
+  std::vector<Triangle> triangles(triangle_count);
+  std::cout << "Load STL: " << triangle_count << " triangles" << std::endl;
+  char const* records = file.data() + STL_HEADER_BYTES;
+  parallel_for(triangle_count,
+               [&](std::size_t i)
+               {
+                 char const* record = records + i * STL_RECORD_BYTES;
+                 Triangle& t = triangles[i];
+                 t.p0 = read_vec3(record + 12);
+                 t.p1 = read_vec3(record + 24);
+                 t.p2 = read_vec3(record + 36);
+               });
+  return triangles;
+}
+
+// normal in the file is ignored, and computed from vertices;
+// one place for both formats, so they give the same bits
+void set_face_normals(std::vector<Triangle>& triangles)
+{
+  parallel_for(triangles.size(),
+               [&](std::size_t i)
+               {
+                 Triangle& t = triangles[i];
+                 vec3 c = (t.p1 - t.p0).cross(t.p2 - t.p0);
+                 c.normalize();
+                 t.n0 = t.n1 = t.n2 = c;
+               });
+}
+
+// for vertex-normals
+// every corner gets the average of face normals of all corners within
+// 1e-3 of it
+void smooth_normals(std::vector<Triangle>& triangles)
+{
+  std::vector<vec3> positions, normals;
+  std::vector<uint32_t> indices;
+  weld_vertices(triangles, 1e-3f, positions, normals, indices);
+  parallel_for(triangles.size(),
+               [&](std::size_t i)
+               {
+                 triangles[i].n0 = normals[indices[3 * i]];
+                 triangles[i].n1 = normals[indices[3 * i + 1]];
+                 triangles[i].n2 = normals[indices[3 * i + 2]];
+               });
+}
+
+namespace
+{
+using cell_t = std::array<int64_t, 3>;
+struct cell_hash
+{
+  std::size_t operator()(cell_t const& c) const
+  {
+    return (uint64_t)c[0] * 73856093u ^ (uint64_t)c[1] * 19349663u
+           ^ (uint64_t)c[2] * 83492791u;
+  }
+};
+}
+
+void weld_vertices(std::vector<Triangle> const& triangles,
+                   float tolerance,
+                   std::vector<vec3>& positions,
+                   std::vector<vec3>& normals,
+                   std::vector<uint32_t>& indices)
+{
+  // vertex indices are 32 bits, and NONE is taken
+  constexpr uint32_t NONE = std::numeric_limits<uint32_t>::max();
+  const std::size_t corner_count = triangles.size() * 3;
+  if (corner_count >= NONE)
+  {
+    throw std::runtime_error("weld_vertices: too many triangles");
+  }
+  const auto corner = [&](std::size_t c) -> vec3 const&
+  {
+    Triangle const& t = triangles[c / 3];
+    return c % 3 == 0 ? t.p0 : (c % 3 == 1 ? t.p1 : t.p2);
+  };
+
+  // grid of cell size 2 * tolerance; corners within tolerance of p are in
+  // p's cell or in the adjacent cells on the nearer side, 8 cells at most
+  const float scale = 0.5f / tolerance;
+  const float tolerance2 = tolerance * tolerance;
+  const auto cell_of = [&](vec3 const& p)
+  {
+    return cell_t { (int64_t)std::floor(p.x() * scale),
+                    (int64_t)std::floor(p.y() * scale),
+                    (int64_t)std::floor(p.z() * scale) };
+  };
+  std::vector<cell_t> cells(corner_count);
+  parallel_for(corner_count,
+               [&](std::size_t c) { cells[c] = cell_of(corner(c)); });
+
+  // first vertex of each cell, and next vertex in the same cell
+  std::unordered_map<cell_t, uint32_t, cell_hash> first;
+  first.reserve(corner_count);
+  std::vector<uint32_t> next;
+
+  // functor(v) for vertices within tolerance of p, until it returns true
+  // own cell first, where most of them are
+  const auto for_each_near
+      = [&](vec3 const& p, cell_t const& cell, auto functor)
+  {
+    int64_t side[3];
+    for (int a = 0; a < 3; ++a)
+    {
+      side[a] = p[a] * scale - cell[a] < 0.5f ? -1 : 1;
+    }
+    for (int k = 0; k < 8; ++k)
+    {
+      auto it = first.find({ cell[0] + ((k & 1) ? side[0] : 0),
+                             cell[1] + ((k & 2) ? side[1] : 0),
+                             cell[2] + ((k & 4) ? side[2] : 0) });
+      if (it == first.end())
+      {
+        continue;
+      }
+      for (uint32_t v = it->second; v != NONE; v = next[v])
+      {
+        if ((positions[v] - p).squaredNorm() < tolerance2 && functor(v))
+        {
+          return;
+        }
       }
     }
-    new_triangles[i].n2 = normal / cnt;
+  };
 
-    new_triangles[i].n0.normalize();
-    new_triangles[i].n1.normalize();
-    new_triangles[i].n2.normalize();
+  // corners are welded in order, on this thread only;
+  // the first corner of a group is kept
+  positions.clear();
+  indices.resize(corner_count);
+  for (std::size_t c = 0; c < corner_count; ++c)
+  {
+    vec3 const& p = corner(c);
+    uint32_t v = NONE;
+    for_each_near(p, cells[c],
+                  [&](uint32_t u)
+                  {
+                    v = u;
+                    return true;
+                  });
+    if (v == NONE)
+    {
+      v = positions.size();
+      positions.push_back(p);
+      auto it = first.emplace(cells[c], NONE).first;
+      next.push_back(it->second);
+      it->second = v;
+    }
+    indices[c] = v;
   }
 
-  return new_triangles;
+  // sum of face normals of corners welded into each vertex
+  std::vector<vec3> face_normals(triangles.size());
+  parallel_for(triangles.size(),
+               [&](std::size_t i)
+               {
+                 Triangle const& t = triangles[i];
+                 face_normals[i] = (t.p1 - t.p0).cross(t.p2 - t.p0);
+                 face_normals[i].normalize();
+               });
+  std::vector<vec3> sums(positions.size(), vec3::Zero());
+  for (std::size_t c = 0; c < corner_count; ++c)
+  {
+    sums[indices[c]] += face_normals[c / 3];
+  }
+
+  // welding is greedy; neighbor vertices within tolerance count too
+  normals.resize(positions.size());
+  parallel_for(positions.size(),
+               [&](std::size_t v)
+               {
+                 vec3 sum = vec3::Zero();
+                 for_each_near(positions[v], cell_of(positions[v]),
+                               [&](uint32_t u)
+                               {
+                                 sum += sums[u];
+                                 return false;
+                               });
+                 normals[v] = sum.normalized();
+               });
+}
+// vertices of triangles in the file, either format; no normals
+std::vector<Triangle> read_stl(std::string const& filename)
+{
+  const MappedFile file = open_stl(filename);
+  uint32_t triangle_count;
+  return is_binary_stl(file, triangle_count)
+             ? load_stl_binary(file, triangle_count)
+             : load_stl_ascii(file);
 }
 std::vector<Triangle> load_stl(std::string const& filename, bool vertex_normal)
 {
-  std::ifstream ifs(filename, std::ios::binary);
-  char first_five_bytes[5];
-  ifs.read(first_five_bytes, 5);
-  ifs.close();
+  std::vector<Triangle> triangles = read_stl(filename);
+  set_face_normals(triangles);
+  if (vertex_normal)
+  {
+    smooth_normals(triangles);
+  }
+  return triangles;
+}
+
+void load_stl_mesh(std::string const& filename, TriangleMesh& mesh)
+{
+  const std::vector<Triangle> triangles = read_stl(filename);
+  std::vector<uint32_t> indices;
+  weld_vertices(triangles, 1e-3f, mesh.positions, mesh.normals, indices);
 
-  if (std::string(first_five_bytes, 5) != "solid")
+  // a welded vertex is at the first corner of its group; other corners
+  // of the group not exactly there get vertices of their own, with the
+  // same normal, so the surface is kept as in the file. they are rare
+  std::map<std::pair<uint32_t, std::array<float, 3>>, uint32_t> moved;
+  mesh.faces.resize(triangles.size());
+  for (std::size_t i = 0; i < triangles.size(); ++i)
   {
-    // binary
-    ifs = std::ifstream(filename, std::ios::binary);
-    return load_stl_binary(ifs, vertex_normal);
+    Triangle const& t = triangles[i];
+    vec3 const* corners[3] = { &t.p0, &t.p1, &t.p2 };
+    for (int k = 0; k < 3; ++k)
+    {
+      vec3 const& p = *corners[k];
+      uint32_t v = indices[3 * i + k];
+      if (p != mesh.positions[v])
+      {
+        auto it = moved.emplace(
+            std::make_pair(v, std::array<float, 3> { p.x(), p.y(), p.z() }),
+            mesh.positions.size());
+        if (it.second)
+        {
+          mesh.positions.push_back(p);
+          mesh.normals.push_back(mesh.normals[v]);
+        }
+        v = it.first->second;
+      }
+      mesh.faces[i].v[k] = v;
+    }
   }
-  ifs = std::ifstream(filename);
-  return load_stl_ascii(ifs);
+  mesh.material_ids.clear();
+  mesh.materials.clear();
+  mesh.build();
+}
+
+std::vector<vec3> load_stl_positions(std::string const& filename)
+{
+  const MappedFile file = open_stl(filename);
+  uint32_t triangle_count;
+  if (is_binary_stl(file, triangle_count) == false)
+  {
+    std::vector<vec3> positions;
+    for (auto const& t : load_stl_ascii(file))
+    {
+      positions.push_back(t.p0);
+      positions.push_back(t.p1);
+      positions.push_back(t.p2);
+    }
+    return positions;
+  }
+
+  // 3 vertices are contiguous in a record
+  std::vector<vec3> positions(3 * std::size_t(triangle_count));
+  char const* records = file.data() + STL_HEADER_BYTES;
+  parallel_for(triangle_count,
+               [&](std::size_t i)
+               {
+                 std::memcpy(positions[3 * i].data(),
+                             records + i * STL_RECORD_BYTES + 12, 36);
+               });
+  return positions;
 }
 
 void write_stl(std::string const& filename,
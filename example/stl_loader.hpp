@@ -1,13 +1,34 @@
 #pragma once
 
+#include <cstdint>
 #include <geometry.hpp>
 #include <string>
 #include <vector>
 
 namespace eh
 {
+struct TriangleMesh;
+
 std::vector<Triangle> load_stl(std::string const& filename,
                                bool vertex_normal = false);
+// indexed mesh straight from weld_vertices(), with the same normals as
+// load_stl(filename, true); no triangle soup is welded again by assign()
+void load_stl_mesh(std::string const& filename, TriangleMesh& mesh);
+// vertices of triangles only, 3 per triangle in file order;
+// 36 bytes per triangle instead of a Triangle object
+std::vector<vec3> load_stl_positions(std::string const& filename);
 void write_stl(std::string const& filename,
                std::vector<Triangle> const& triangles);
+
+// merge corners of triangles within `tolerance` of each other into
+// shared vertices, with normal averaged from faces around each vertex.
+// indices: 3 vertex indices per triangle
+// grid cells and normals are computed on all threads, but the weld
+// itself is one serial pass over corners in order, as it is greedy;
+// throws std::runtime_error if corners do not fit in 32 bits indices
+void weld_vertices(std::vector<Triangle> const& triangles,
+                   float tolerance,
+                   std::vector<vec3>& positions,
+                   std::vector<vec3>& normals,
+                   std::vector<uint32_t>& indices);
 }
\ No newline at end of file
@@ -1,10 +1,17 @@
 #pragma once
 
 #include "geometry.hpp"
+#include "mesh.hpp"
 #include "reflection.hpp"
+#include "scene_cache.hpp"
 #include "stl_loader.hpp"
 #include "world.hpp"
 
+// directory for built mesh caches; set by cmake to the build directory
+#ifndef MESH_CACHE_DIR
+#define MESH_CACHE_DIR "."
+#endif
+
 // base demo world;
 class TeapotDemo : public eh::World
 {
@@ -33,6 +40,9 @@ class TeapotDemo : public eh::World
   };
 
 public:
+  // scene cache key of load_stl_mesh(), with vertex normals
+  constexpr static std::uint64_t VERTEX_NORMAL_KEY = 1;
+
   struct
   {
     eh::Sphere skysphere { eh::vec3::Zero(), 100.0f };
@@ -50,7 +60,9 @@ public:
                           vec3(0, 1, 0),
                           vec3(0, 1, 0) };
 
-    std::vector<eh::Triangle> teapot;
+    // shared mesh, placed on the floor by teapot_instance
+    eh::TriangleMesh teapot;
+    eh::MeshInstance teapot_instance;
   } geometries;
 
   struct
@@ -73,27 +85,21 @@ public:
     this->max_bounce = 3;
     this->init(w, h, thread_count);
 
-    geometries.teapot = eh::load_stl(TEAPOT_PATH, true);
-    for (auto& t : geometries.teapot)
-    {
-      t.p0.x() += 0.2f;
-      t.p1.x() += 0.2f;
-      t.p2.x() += 0.2f;
-      t.p0.y() -= 2;
-      t.p1.y() -= 2;
-      t.p2.y() -= 2;
-      t.p0.z() -= 10;
-      t.p1.z() -= 10;
-      t.p2.z() -= 10;
-    }
-
-    this->insert({ &geometries.skysphere, &reflections.lightsource });
-    this->insert({ &geometries.floor1, &reflections.floor });
-    this->insert({ &geometries.floor2, &reflections.floor });
-    for (auto& t : geometries.teapot)
-    {
-      this->insert({ &t, &reflections.diffusive });
-    }
+    // built mesh is kept in MESH_CACHE_DIR; rebuilt when the STL changes
+    eh::load_mesh_cached(
+        geometries.teapot, TEAPOT_PATH,
+        MESH_CACHE_DIR "/utah_teapot.stl.meshcache",
+        [](eh::TriangleMesh& mesh) { eh::load_stl_mesh(TEAPOT_PATH, mesh); },
+        VERTEX_NORMAL_KEY);
+    geometries.teapot_instance
+        = eh::MeshInstance(&geometries.teapot, vec3(0.2f, -2.0f, -10.0f));
+
+    std::vector<eh::Object> scene;
+    scene.push_back({ &geometries.skysphere, &reflections.lightsource });
+    scene.push_back({ &geometries.floor1, &reflections.floor });
+    scene.push_back({ &geometries.floor2, &reflections.floor });
+    scene.push_back({ &geometries.teapot_instance, &reflections.diffusive });
+    this->build(scene);
     reflections.fuzzy_mirror.fuzzyness = 0.05f;
     reflections.fuzzy_mirror.sample_count = 5;
     reflections.fuzzy_mirror.color = vec3(0.8f, 0.8f, 0.8f);
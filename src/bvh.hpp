@@ -0,0 +1,614 @@
+#pragma once
+
+#include "geometry.hpp"
+#include "math.hpp"
+#include "parallel.hpp"
+#include "ray.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <utility>
+#include <vector>
+
+namespace eh
+{
+
+/*
+  Bounding Volume Hierarchy
+  binary tree built top-down with binned Surface Area Heuristic.
+
+  cost of a split = C_trav + SA(left)/SA(parent) * N_left * C_isect
+                           + SA(right)/SA(parent) * N_right * C_isect
+  which estimates the expected cost of a ray traversing the node,
+  rather than area/overlap of R*-tree that is optimised for window queries.
+*/
+template <typename MappedType>
+class BVH
+{
+public:
+  using mapped_type = MappedType;
+  using value_type = std::pair<BoundingBox, mapped_type>;
+  using size_type = std::uint32_t;
+
+  struct node_t
+  {
+    BoundingBox bound;
+
+    // leaf node: index of the first primitive
+    // internal node: index of the second child;
+    //                first child is always placed right after this node
+    size_type offset;
+
+    // the number of primitives; 0 for internal node
+    size_type size;
+  };
+
+  // number of bins per axis for evaluating SAH
+  constexpr static int BIN_COUNT = 16;
+  // always make leaf if primitives are less than or equal to this
+  constexpr static size_type MIN_LEAF_SIZE = 2;
+  // never make leaf if primitives are more than this
+  constexpr static size_type MAX_LEAF_SIZE = 8;
+
+  // relative costs for SAH
+  constexpr static float TRAVERSAL_COST = 1.0f;
+  constexpr static float INTERSECTION_COST = 1.0f;
+
+  // nodes with less primitives than this are built on a single thread
+  constexpr static size_type PARALLEL_SIZE = 4096;
+
+  // SAH may split 1 vs n-1 on skewed inputs; past this depth nodes are
+  // split at the median instead, which adds at most 32 more levels
+  constexpr static int MAX_SAH_DEPTH = 64;
+  // traversal stack; holds at most one entry per level plus one
+  constexpr static int STACK_SIZE = 128;
+
+protected:
+  std::vector<node_t> _nodes;
+  std::vector<value_type> _primitives;
+
+  struct bin_t
+  {
+    BoundingBox bound = BoundingBox::empty();
+    size_type count = 0;
+  };
+  // bins of x, y, z axis
+  struct bins_t
+  {
+    bin_t axis[3][BIN_COUNT];
+  };
+
+  // bound of primitives [begin, end) and of their centroids
+  void compute_bound(size_type begin,
+                     size_type end,
+                     BoundingBox& bound,
+                     BoundingBox& centroid_bound,
+                     unsigned int thread_count) const
+  {
+    bound = BoundingBox::empty();
+    centroid_bound = BoundingBox::empty();
+    if (thread_count == 1 || end - begin < PARALLEL_SIZE)
+    {
+      for (size_type i = begin; i < end; ++i)
+      {
+        bound = bound.merged(_primitives[i].first);
+        centroid_bound = centroid_bound.merged(centroid(_primitives[i].first));
+      }
+      return;
+    }
+    std::vector<BoundingBox> bounds(2 * thread_count, BoundingBox::empty());
+    parallel_chunks(
+        end - begin,
+        [&](unsigned int t, std::size_t first, std::size_t last)
+        {
+          BoundingBox b = BoundingBox::empty();
+          BoundingBox c = BoundingBox::empty();
+          for (size_type i = begin + first; i < begin + last; ++i)
+          {
+            b = b.merged(_primitives[i].first);
+            c = c.merged(centroid(_primitives[i].first));
+          }
+          bounds[2 * t] = b;
+          bounds[2 * t + 1] = c;
+        },
+        thread_count);
+    for (unsigned int t = 0; t < thread_count; ++t)
+    {
+      bound = bound.merged(bounds[2 * t]);
+      centroid_bound = centroid_bound.merged(bounds[2 * t + 1]);
+    }
+  }
+
+  // build subtree for primitives [begin, end) at the back of `nodes`
+  // returns index of the node
+  // with thread_count > 1, the second subtree is built into its own array
+  // on another thread and appended after the first one
+  size_type build_recursive(std::vector<node_t>& nodes,
+                            size_type begin,
+                            size_type end,
+                            unsigned int thread_count,
+                            int depth = 0)
+  {
+    const size_type this_index = nodes.size();
+    nodes.emplace_back();
+
+    BoundingBox bound, centroid_bound;
+    compute_bound(begin, end, bound, centroid_bound, thread_count);
+    nodes[this_index].bound = bound;
+
+    const size_type n = end - begin;
+    size_type mid = begin;
+    if (depth >= MAX_SAH_DEPTH)
+    {
+      if (n > MAX_LEAF_SIZE)
+      {
+        mid = split_median(begin, end, centroid_bound);
+      }
+    }
+    else if (n > MIN_LEAF_SIZE)
+    {
+      mid = split(begin, end, bound, centroid_bound, thread_count);
+    }
+    if (mid == begin)
+    {
+      nodes[this_index].offset = begin;
+      nodes[this_index].size = n;
+      return this_index;
+    }
+
+    size_type second;
+    if (thread_count > 1 && n >= PARALLEL_SIZE)
+    {
+      const unsigned int half = thread_count / 2;
+      std::vector<node_t> second_nodes;
+      second_nodes.reserve(2 * (end - mid));
+      parallel_invoke(
+          [&]() { build_recursive(second_nodes, mid, end, half, depth + 1); },
+          [&]()
+          {
+            build_recursive(nodes, begin, mid, thread_count - half,
+                            depth + 1);
+          },
+          thread_count);
+
+      // child offsets of the second subtree are relative to its own array
+      second = nodes.size();
+      for (node_t node : second_nodes)
+      {
+        if (node.size == 0)
+        {
+          node.offset += second;
+        }
+        nodes.push_back(node);
+      }
+    }
+    else
+    {
+      build_recursive(nodes, begin, mid, 1, depth + 1);
+      second = build_recursive(nodes, mid, end, 1, depth + 1);
+    }
+    nodes[this_index].offset = second;
+    nodes[this_index].size = 0;
+    return this_index;
+  }
+
+  // bins of all 3 axes for primitives [begin, end)
+  // scale[axis] is 0 for flat axis, which is not binned
+  void fill_bins(size_type begin,
+                 size_type end,
+                 vec3 const& min,
+                 vec3 const& scale,
+                 bins_t& bins) const
+  {
+    for (size_type i = begin; i < end; ++i)
+    {
+      const vec3 c = centroid(_primitives[i].first);
+      for (int axis = 0; axis < 3; ++axis)
+      {
+        if (scale[axis] == 0)
+        {
+          continue;
+        }
+        const int b = bin_index(c[axis], min[axis], scale[axis]);
+        bin_t& bin = bins.axis[axis][b];
+        bin.bound = bin.bound.merged(_primitives[i].first);
+        ++bin.count;
+      }
+    }
+  }
+
+  // partition primitives [begin, end) by binned SAH
+  // returns the split point, or `begin` if leaf is cheaper
+  size_type split(size_type begin,
+                  size_type end,
+                  BoundingBox const& bound,
+                  BoundingBox const& centroid_bound,
+                  unsigned int thread_count)
+  {
+    const size_type n = end - begin;
+    const vec3 extent = centroid_bound.max_ - centroid_bound.min_;
+    vec3 scales = vec3::Zero();
+    for (int axis = 0; axis < 3; ++axis)
+    {
+      if (extent[axis] > 0)
+      {
+        scales[axis] = BIN_COUNT / extent[axis];
+      }
+    }
+
+    // each thread fills its own bins, then they are summed up
+    bins_t bins;
+    if (thread_count == 1 || n < PARALLEL_SIZE)
+    {
+      fill_bins(begin, end, centroid_bound.min_, scales, bins);
+    }
+    else
+    {
+      std::vector<bins_t> thread_bins(thread_count);
+      parallel_chunks(
+          n,
+          [&](unsigned int t, std::size_t first, std::size_t last)
+          {
+            fill_bins(begin + first, begin + last, centroid_bound.min_,
+                      scales, thread_bins[t]);
+          },
+          thread_count);
+      for (bins_t const& src : thread_bins)
+      {
+        for (int axis = 0; axis < 3; ++axis)
+        {
+          for (int b = 0; b < BIN_COUNT; ++b)
+          {
+            bin_t& dst = bins.axis[axis][b];
+            dst.bound = dst.bound.merged(src.axis[axis][b].bound);
+            dst.count += src.axis[axis][b].count;
+          }
+        }
+      }
+    }
+
+    int best_axis = -1;
+    int best_bin = 0;
+    float best_cost = std::numeric_limits<float>::infinity();
+    for (int axis = 0; axis < 3; ++axis)
+    {
+      if (extent[axis] <= 0)
+      {
+        continue;
+      }
+      bin_t const(&bin)[BIN_COUNT] = bins.axis[axis];
+
+      // sweep from right to get area of right side of each plane
+      float right_area[BIN_COUNT];
+      size_type right_count[BIN_COUNT];
+      BoundingBox acc = BoundingBox::empty();
+      size_type count = 0;
+      for (int b = BIN_COUNT - 1; b > 0; --b)
+      {
+        acc = acc.merged(bin[b].bound);
+        count += bin[b].count;
+        right_area[b] = acc.surface_area();
+        right_count[b] = count;
+      }
+
+      // plane b splits bins [0, b) and [b, BIN_COUNT)
+      acc = BoundingBox::empty();
+      count = 0;
+      for (int b = 1; b < BIN_COUNT; ++b)
+      {
+        acc = acc.merged(bin[b - 1].bound);
+        count += bin[b - 1].count;
+        if (count == 0 || right_count[b] == 0)
+        {
+          continue;
+        }
+        const float cost = acc.surface_area() * count
+                           + right_area[b] * right_count[b];
+        if (cost < best_cost)
+        {
+          best_cost = cost;
+          best_axis = axis;
+          best_bin = b;
+        }
+      }
+    }
+
+    if (best_axis == -1)
+    {
+      // all centroids are on the same point
+      if (n <= MAX_LEAF_SIZE)
+      {
+        return begin;
+      }
+      return begin + n / 2;
+    }
+
+    const float leaf_cost = n * INTERSECTION_COST;
+    best_cost = TRAVERSAL_COST
+                + INTERSECTION_COST * best_cost / bound.surface_area();
+    if (best_cost >= leaf_cost && n <= MAX_LEAF_SIZE)
+    {
+      return begin;
+    }
+
+    const float scale = scales[best_axis];
+    const float min = centroid_bound.min_[best_axis];
+    auto mid = std::partition(
+        _primitives.begin() + begin, _primitives.begin() + end,
+        [&](value_type const& p)
+        {
+          return bin_index(centroid(p.first)[best_axis], min, scale)
+                 < best_bin;
+        });
+    return std::distance(_primitives.begin(), mid);
+  }
+
+  // partition primitives [begin, end) into halves
+  // along the longest axis of the centroids
+  size_type split_median(size_type begin,
+                         size_type end,
+                         BoundingBox const& centroid_bound)
+  {
+    const vec3 extent = centroid_bound.max_ - centroid_bound.min_;
+    int axis;
+    extent.maxCoeff(&axis);
+    const size_type mid = begin + (end - begin) / 2;
+    std::nth_element(_primitives.begin() + begin, _primitives.begin() + mid,
+                     _primitives.begin() + end,
+                     [axis](value_type const& a, value_type const& b)
+                     {
+                       return centroid(a.first)[axis]
+                              < centroid(b.first)[axis];
+                     });
+    return mid;
+  }
+
+  // center of the bound; unbounded axis is treated as 0
+  static vec3 centroid(BoundingBox const& b)
+  {
+    vec3 c = b.center();
+    for (int i = 0; i < 3; ++i)
+    {
+      if (std::isfinite(c[i]) == false)
+      {
+        c[i] = 0;
+      }
+    }
+    return c;
+  }
+  static int bin_index(float c, float min, float scale)
+  {
+    return std::min(static_cast<int>((c - min) * scale), BIN_COUNT - 1);
+  }
+
+public:
+  // build hierarchy from scratch
+  // existing primitives are discarded
+  // thread_count: threads for binning and for building subtrees;
+  // the result is same for any thread_count
+  template <typename Iterator>
+  void build(Iterator first, Iterator last, unsigned int thread_count = 1)
+  {
+    _primitives.assign(first, last);
+    _nodes.clear();
+    if (_primitives.empty())
+    {
+      return;
+    }
+    _nodes.reserve(2 * _primitives.size());
+    build_recursive(_nodes, 0, _primitives.size(),
+                    std::max(1u, thread_count));
+  }
+
+  void clear()
+  {
+    _nodes.clear();
+    _primitives.clear();
+  }
+
+  std::vector<node_t> const& nodes() const
+  {
+    return _nodes;
+  }
+  std::vector<value_type> const& primitives() const
+  {
+    return _primitives;
+  }
+  size_type size() const
+  {
+    return _primitives.size();
+  }
+
+  // recompute bounds after primitives moved, keeping the hierarchy
+  // bound_of( mapped_type const& ) returns the new bound of primitive
+  template <typename Functor>
+  void refit(Functor bound_of)
+  {
+    for (auto& p : _primitives)
+    {
+      p.first = bound_of(p.second);
+    }
+    // children are always placed after their parent
+    for (size_type i = _nodes.size(); i-- > 0;)
+    {
+      node_t& node = _nodes[i];
+      if (node.size > 0)
+      {
+        node.bound = BoundingBox::empty();
+        for (size_type j = node.offset; j < node.offset + node.size; ++j)
+        {
+          node.bound = node.bound.merged(_primitives[j].first);
+        }
+      }
+      else
+      {
+        node.bound = _nodes[i + 1].bound.merged(_nodes[node.offset].bound);
+      }
+    }
+  }
+
+  // expected cost of a ray traversing the hierarchy, up to a constant factor
+  // sum of surface area of non-root nodes, weighted by traversal cost,
+  // and of leaf nodes, weighted by the number of primitives in it.
+  // unbounded nodes are skipped.
+  float sah_cost() const
+  {
+    float cost = 0;
+    for (size_type i = 1; i < _nodes.size(); ++i)
+    {
+      const float area = _nodes[i].bound.surface_area();
+      if (std::isfinite(area) == false)
+      {
+        continue;
+      }
+      cost += area * (TRAVERSAL_COST + _nodes[i].size * INTERSECTION_COST);
+    }
+    return cost;
+  }
+
+  // any-hit traversal; returns true as soon as functor returns true
+  // functor( mapped_type const& ) tests if ray hits the primitive before tmax
+  template <typename Functor>
+  bool occluded(Ray const& ray,
+                float tmax,
+                Functor functor,
+                TraversalStats* stats = nullptr) const
+  {
+    if (_nodes.empty())
+    {
+      return false;
+    }
+
+    size_type stack[STACK_SIZE];
+    int stack_size = 0;
+    stack[stack_size++] = 0;
+    while (stack_size > 0)
+    {
+      const size_type index = stack[--stack_size];
+      node_t const& node = _nodes[index];
+      float t0, t1;
+      if (node.bound.raycast(ray, t0, t1) == false || tmax < t0)
+      {
+        continue;
+      }
+      if (stats)
+      {
+        stats->visit_node(&node, sizeof(node));
+      }
+      if (node.size > 0)
+      {
+        for (size_type i = node.offset; i < node.offset + node.size; ++i)
+        {
+          if (_primitives[i].first.raycast(ray, t0, t1) == false
+              || tmax < t0)
+          {
+            continue;
+          }
+          if (stats)
+          {
+            stats->visit_primitive(&_primitives[i], sizeof(value_type));
+          }
+          if (functor(_primitives[i].second))
+          {
+            return true;
+          }
+        }
+        continue;
+      }
+      assert(stack_size + 2 <= STACK_SIZE);
+      stack[stack_size++] = node.offset;
+      stack[stack_size++] = index + 1;
+    }
+    return false;
+  }
+
+  // closest-hit traversal
+  // functor( mapped_type const&, RayHit& cur ) tests ray against the primitive
+  // and updates `cur` if closer hit was found
+  // children are always visited front-to-back
+  template <typename Functor>
+  void raycast(Ray const& ray,
+               RayHit& cur,
+               Functor functor,
+               TraversalStats* stats = nullptr) const
+  {
+    if (_nodes.empty())
+    {
+      return;
+    }
+
+    float tmin, tmax;
+    if (_nodes[0].bound.raycast(ray, tmin, tmax) == false)
+    {
+      return;
+    }
+
+    size_type stack[STACK_SIZE];
+    int stack_size = 0;
+    stack[stack_size++] = 0;
+    while (stack_size > 0)
+    {
+      node_t const& node = _nodes[stack[--stack_size]];
+      if (stats)
+      {
+        stats->visit_node(&node, sizeof(node));
+      }
+      if (node.size > 0)
+      {
+        for (size_type i = node.offset; i < node.offset + node.size; ++i)
+        {
+          if (_primitives[i].first.raycast(ray, tmin, tmax) == false)
+          {
+            continue;
+          }
+          if (cur.t < tmin)
+          {
+            continue;
+          }
+          if (stats)
+          {
+            stats->visit_primitive(&_primitives[i], sizeof(value_type));
+          }
+          functor(_primitives[i].second, cur);
+        }
+        continue;
+      }
+
+      // push far child first, so that near child is visited first
+      const size_type first = &node - _nodes.data() + 1;
+      const size_type second = node.offset;
+      float t1, t2;
+      const bool hit1
+          = _nodes[first].bound.raycast(ray, t1, tmax) && t1 <= cur.t;
+      const bool hit2
+          = _nodes[second].bound.raycast(ray, t2, tmax) && t2 <= cur.t;
+      assert(stack_size + 2 <= STACK_SIZE);
+      if (hit1 && hit2)
+      {
+        if (t1 <= t2)
+        {
+          stack[stack_size++] = second;
+          stack[stack_size++] = first;
+        }
+        else
+        {
+          stack[stack_size++] = first;
+          stack[stack_size++] = second;
+        }
+      }
+      else if (hit1)
+      {
+        stack[stack_size++] = first;
+      }
+      else if (hit2)
+      {
+        stack[stack_size++] = second;
+      }
+    }
+  }
+};
+
+}
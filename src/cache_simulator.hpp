@@ -0,0 +1,72 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace eh
+{
+
+/*
+  set-associative LRU cache, simulated on addresses of fetched nodes to
+  count misses; disabled (never misses) until resize().
+  with 4 KiB lines, it works as a TLB of pages.
+*/
+class CacheSimulator
+{
+protected:
+  // line address of each way, most recently used first in each set;
+  // 0 for empty way
+  std::vector<std::uintptr_t> _lines;
+  unsigned int _ways = 0;
+  std::size_t _sets = 0;
+  std::size_t _line_size = 64;
+
+public:
+  // the number of sets, bytes / line_size / ways, must be a power of 2
+  void resize(std::size_t bytes, unsigned int ways, std::size_t line_size = 64)
+  {
+    assert(ways > 0 && line_size > 0);
+    _ways = ways;
+    _line_size = line_size;
+    _sets = bytes / line_size / ways;
+    assert((_sets & (_sets - 1)) == 0);
+    _lines.assign(_sets * _ways, 0);
+  }
+  void clear()
+  {
+    std::fill(_lines.begin(), _lines.end(), 0);
+  }
+
+  // access `bytes` from `p`; returns the number of lines missed
+  unsigned int access(void const* p, std::size_t bytes)
+  {
+    if (_sets == 0)
+    {
+      return 0;
+    }
+    unsigned int misses = 0;
+    const std::uintptr_t first = (std::uintptr_t)p / _line_size;
+    const std::uintptr_t last = ((std::uintptr_t)p + bytes - 1) / _line_size;
+    for (std::uintptr_t line = first; line <= last; ++line)
+    {
+      // +1; 0 is empty way
+      const std::uintptr_t tag = line + 1;
+      std::uintptr_t* set = _lines.data() + (line & (_sets - 1)) * _ways;
+      unsigned int way = 0;
+      while (way < _ways - 1 && set[way] != tag)
+      {
+        ++way;
+      }
+      misses += set[way] != tag;
+      // move to front; evicts the last way on miss
+      std::copy_backward(set, set + way, set + way + 1);
+      set[0] = tag;
+    }
+    return misses;
+  }
+};
+
+}
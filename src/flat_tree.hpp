@@ -0,0 +1,151 @@
+#pragma once
+
+#include "geometry.hpp"
+#include "ray.hpp"
+#include "stack_traversal.hpp"
+
+#include <cassert>
+
+namespace eh
+{
+
+/*
+  read-only traversal over RTree::flatten() result
+
+  nodes and children bounds are in contiguous buffers,
+  so the traversal runs an explicit-stack loop instead of recursive calls
+  chasing node pointers.
+*/
+
+// calls visit( i, tnear ) for children of `node` hit before tmax,
+// as stack_raycast() wants
+template <typename FlattenResult, typename Node, typename Visit>
+bool flat_visit_children(FlattenResult const& tree,
+                         Node const& node,
+                         Ray const& ray,
+                         float const& tmax,
+                         bool reverse,
+                         TraversalStats* stats,
+                         Visit visit)
+{
+  using size_type = decltype(tree.leaf_level);
+  if (stats)
+  {
+    stats->visit_node(&tree.children_bound[node.offset],
+                      node.size * sizeof(tree.children_bound[0]));
+  }
+  for (size_type k = 0; k < node.size; ++k)
+  {
+    const size_type i = reverse ? node.size - 1 - k : k;
+    float tmin, t1;
+    if (tree.children_bound[node.offset + i].raycast(ray, tmin, t1) == false
+        || tmax < tmin)
+    {
+      continue;
+    }
+    if (visit(i, tmin))
+    {
+      return true;
+    }
+  }
+  return false;
+}
+
+// closest-hit traversal
+// functor( mapped_type const&, RayHit& cur ) tests ray against the data
+// and updates `cur` if closer hit was found
+//
+// ordered: visit children front-to-back by their slab entry distance,
+//          so that the closest hit is found early and culls the rest.
+// stats: if not null, visited nodes and tested primitives are counted.
+template <typename FlattenResult, typename Functor>
+void flat_raycast(FlattenResult const& tree,
+                  Ray const& ray,
+                  RayHit& cur,
+                  Functor functor,
+                  bool ordered = false,
+                  TraversalStats* stats = nullptr)
+{
+  using size_type = decltype(tree.leaf_level);
+  if (tree.nodes.empty())
+  {
+    return;
+  }
+
+  struct entry_t
+  {
+    size_type index;
+    size_type level;
+  };
+  stack_raycast(
+      entry_t { tree.root, 0 }, cur, ordered,
+      [&](entry_t const& e) { return e.level == tree.leaf_level; },
+      [&](entry_t const& e, float const& tmax, bool reverse, auto visit)
+      {
+        return flat_visit_children(tree, tree.nodes[e.index], ray, tmax,
+                                   reverse, stats, visit);
+      },
+      [&](entry_t const& e, int i)
+      {
+        return entry_t { tree.children[tree.nodes[e.index].offset + i],
+                         size_type(e.level + 1) };
+      },
+      [&](entry_t const& e, int i, RayHit& hit)
+      {
+        auto const& data
+            = tree.data[tree.children[tree.nodes[e.index].offset + i]];
+        if (stats)
+        {
+          stats->visit_primitive(&data, sizeof(data));
+        }
+        functor(data, hit);
+      });
+}
+
+// any-hit traversal; returns true as soon as functor returns true
+// functor( mapped_type const& ) tests if ray hits the data before tmax
+// no ordering; any hit terminates the traversal
+template <typename FlattenResult, typename Functor>
+bool flat_occluded(FlattenResult const& tree,
+                   Ray const& ray,
+                   float tmax,
+                   Functor functor,
+                   TraversalStats* stats = nullptr)
+{
+  using size_type = decltype(tree.leaf_level);
+  if (tree.nodes.empty())
+  {
+    return false;
+  }
+
+  struct entry_t
+  {
+    size_type index;
+    size_type level;
+  };
+  return stack_occluded(
+      entry_t { tree.root, 0 }, tmax,
+      [&](entry_t const& e) { return e.level == tree.leaf_level; },
+      [&](entry_t const& e, float const& t, bool reverse, auto visit)
+      {
+        return flat_visit_children(tree, tree.nodes[e.index], ray, t,
+                                   reverse, stats, visit);
+      },
+      [&](entry_t const& e, int i)
+      {
+        return entry_t { tree.children[tree.nodes[e.index].offset + i],
+                         size_type(e.level + 1) };
+      },
+      [&](entry_t const& e, int i)
+      {
+        auto const& data
+            = tree.data[tree.children[tree.nodes[e.index].offset + i]];
+        if (stats)
+        {
+          stats->visit_primitive(&data, sizeof(data));
+        }
+        return functor(data);
+      });
+}
+
+}
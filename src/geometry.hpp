@@ -4,6 +4,7 @@
 #include "math.hpp"
 #include "ray.hpp"
 #include <cmath>
+#include <limits>
 #include <utility>
 
 namespace eh
@@ -31,6 +32,34 @@ struct BoundingBox
     return (max_.x() - min_.x()) * (max_.y() - min_.y())
            * (max_.z() - min_.z());
   }
+  // half of the surface area; used in surface area heuristic
+  float surface_area() const
+  {
+    const vec3 d = max_ - min_;
+    return d.x() * d.y() + d.y() * d.z() + d.z() * d.x();
+  }
+  vec3 center() const
+  {
+    return (min_ + max_) * 0.5f;
+  }
+  BoundingBox merged(BoundingBox const& b) const
+  {
+    return { min_.cwiseMin(b.min_), max_.cwiseMax(b.max_) };
+  }
+  BoundingBox merged(vec3 const& p) const
+  {
+    return { min_.cwiseMin(p), max_.cwiseMax(p) };
+  }
+  bool is_finite() const
+  {
+    return min_.allFinite() && max_.allFinite();
+  }
+  // empty box; merging anything into this gives that thing itself
+  static BoundingBox empty()
+  {
+    return { vec3::Constant(std::numeric_limits<float>::infinity()),
+             vec3::Constant(-std::numeric_limits<float>::infinity()) };
+  }
   bool raycast(Ray const& r, float& tmin, float& tmax) const
   {
     float t0 = -std::numeric_limits<float>::infinity();
@@ -71,6 +100,14 @@ struct GeometryObject
   }
   virtual RayHit raycast(Ray const& r) const = 0;
   virtual BoundingBox bounding_box() const = 0;
+
+  // true if ray hits this at any t < tmax; used for shadow rays
+  // geometry can override this to skip computing the normal
+  virtual bool occluded(Ray const& r, float tmax) const
+  {
+    const RayHit hit = raycast(r);
+    return hit.surface && hit.t < tmax;
+  }
 };
 
 // sphere geometry
@@ -221,38 +258,79 @@ struct Triangle : GeometryObject
    *                     ( u )
    * ( p1-p0, p2-p0, -d )( v ) = r0 - p0
    *                     ( t )
+   *
+   * solved by Moller-Trumbore with edges e1 = p1-p0, e2 = p2-p0;
+   * TriangleMesh calls this too, so both give the same bits.
+   * hit is accepted if EPSILON < t < tmax
    */
-  RayHit raycast(Ray const& r) const override
+  static bool intersect(vec3 const& p0,
+                        vec3 const& e1,
+                        vec3 const& e2,
+                        Ray const& r,
+                        float tmax,
+                        float& t,
+                        float& u,
+                        float& v)
   {
-    // form 3x3 matrix
-    const vec3 c0 = p1 - p0;
-    const vec3 c1 = p2 - p0;
-    const vec3 c2 = -r.direction();
-    float det = c0.dot(c1.cross(c2));
+    const vec3 pvec = r.direction().cross(e2);
+    const float det = e1.dot(pvec);
     if (std::abs(det) < EPSILON)
+    {
+      return false;
+    }
+    const float inv_det = 1.0f / det;
+    const vec3 tvec = r.origin() - p0;
+    u = tvec.dot(pvec) * inv_det;
+    if (u < 0 || u > 1)
+    {
+      return false;
+    }
+    const vec3 qvec = tvec.cross(e1);
+    v = r.direction().dot(qvec) * inv_det;
+    if (v < 0 || u + v > 1)
+    {
+      return false;
+    }
+    t = e2.dot(qvec) * inv_det;
+    return t > EPSILON && t < tmax;
+  }
+  // ray nearly parallel to the plane of triangle with edges e1, e2;
+  // same threshold as World::raycast_object() has for the hit normal.
+  // tested on each candidate, so raycast() and occluded() agree
+  static bool grazing(vec3 const& e1, vec3 const& e2, Ray const& r)
+  {
+    const vec3 n = e1.cross(e2);
+    const float nd = n.dot(r.direction());
+    return nd * nd < EPSILON * EPSILON * n.squaredNorm();
+  }
+  RayHit raycast(Ray const& r) const override
+  {
+    float t, u, v;
+    if (intersect(p0, p1 - p0, p2 - p0, r,
+                  std::numeric_limits<float>::infinity(), t, u, v)
+            == false
+        || grazing(p1 - p0, p2 - p0, r))
     {
       return RayHit::no_hit();
     }
-    det = 1.0f / det;
-    const vec3 b = r.origin() - p0;
-    const vec3 r0 = c1.cross(c2);
-    const vec3 r1 = c2.cross(c0);
-    const vec3 r2 = c0.cross(c1);
-
-    const float u = det * r0.dot(b);
-    const float v = det * r1.dot(b);
-    const float t = det * r2.dot(b);
-
-    if (u >= 0 && v >= 0 && u + v <= 1 && t > EPSILON)
+    RayHit ret;
+    ret.t = t;
+    ret.surface = reinterpret_cast<Object const*>(1);
+    ret.normal = n0 + (n1 - n0) * u + (n2 - n0) * v;
+    ret.normal.normalize();
+    // interpolated normal can be perpendicular to the ray even where the
+    // face is not; face normal keeps the hit then
+    if (std::abs(ret.normal.dot(r.direction())) < EPSILON)
     {
-      RayHit ret;
-      ret.t = t;
-      ret.surface = reinterpret_cast<Object const*>(1);
-      ret.normal = n0 + (n1 - n0) * u + (n2 - n0) * v;
-      ret.normal.normalize();
-      return ret;
+      ret.normal = (p1 - p0).cross(p2 - p0).normalized();
     }
-    return RayHit::no_hit();
+    return ret;
+  }
+  bool occluded(Ray const& r, float tmax) const override
+  {
+    float t, u, v;
+    return intersect(p0, p1 - p0, p2 - p0, r, tmax, t, u, v)
+           && grazing(p1 - p0, p2 - p0, r) == false;
   }
   BoundingBox bounding_box() const override
   {
@@ -0,0 +1,257 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define EH_MAPPED_FILE_MMAP 1
+#endif
+
+namespace eh
+{
+
+/*
+  read-only view of a whole file
+
+  the file is mapped into memory with mmap, so nothing is read until
+  the pages are touched. where mmap is not available, the file is read
+  into a buffer instead.
+*/
+class MappedFile
+{
+protected:
+  char const* _data = nullptr;
+  std::size_t _size = 0;
+  bool _mapped = false;
+  // used where mmap is not available
+  std::vector<char> _buffer;
+
+  // only whole pages inside the range are advised
+  void advise(std::size_t offset, std::size_t bytes, bool need) const
+  {
+#if defined(EH_MAPPED_FILE_MMAP) && defined(MADV_DONTNEED)
+    if (_mapped == false || offset >= _size)
+    {
+      return;
+    }
+    const std::size_t page = page_size();
+    const std::size_t begin = (offset + page - 1) / page * page;
+    const std::size_t end = std::min(offset + bytes, _size) / page * page;
+    if (begin < end)
+    {
+      madvise(const_cast<char*>(_data) + begin, end - begin,
+              need ? MADV_WILLNEED : MADV_DONTNEED);
+    }
+#endif
+  }
+
+public:
+  MappedFile()
+  {
+  }
+
+  // unit of the hints below
+  static std::size_t page_size()
+  {
+#if defined(EH_MAPPED_FILE_MMAP)
+    return sysconf(_SC_PAGESIZE);
+#else
+    return 4096;
+#endif
+  }
+  // check is_open() for failure
+  explicit MappedFile(std::string const& filename)
+  {
+    open(filename);
+  }
+  MappedFile(MappedFile const&) = delete;
+  MappedFile& operator=(MappedFile const&) = delete;
+  MappedFile(MappedFile&& rhs)
+  {
+    *this = std::move(rhs);
+  }
+  MappedFile& operator=(MappedFile&& rhs)
+  {
+    if (this != &rhs)
+    {
+      close();
+      _data = rhs._data;
+      _size = rhs._size;
+      _mapped = rhs._mapped;
+      _buffer = std::move(rhs._buffer);
+      rhs._data = nullptr;
+      rhs._size = 0;
+      rhs._mapped = false;
+    }
+    return *this;
+  }
+  ~MappedFile()
+  {
+    close();
+  }
+
+  bool open(std::string const& filename)
+  {
+    close();
+#ifdef EH_MAPPED_FILE_MMAP
+    const int fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+      return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0)
+    {
+      ::close(fd);
+      return false;
+    }
+    _size = st.st_size;
+    if (_size == 0)
+    {
+      ::close(fd);
+      _data = "";
+      return true;
+    }
+    void* p = mmap(nullptr, _size, PROT_READ, MAP_PRIVATE, fd, 0);
+    // mapping stays valid after the descriptor is closed
+    ::close(fd);
+    if (p == MAP_FAILED)
+    {
+      _size = 0;
+      return false;
+    }
+    _data = static_cast<char const*>(p);
+    _mapped = true;
+    return true;
+#else
+    std::ifstream ifs(filename, std::ios::binary | std::ios::ate);
+    if (!ifs)
+    {
+      return false;
+    }
+    _buffer.resize(static_cast<std::size_t>(ifs.tellg()));
+    ifs.seekg(0);
+    ifs.read(_buffer.data(), _buffer.size());
+    _data = _buffer.data();
+    _size = _buffer.size();
+    return true;
+#endif
+  }
+  void close()
+  {
+#ifdef EH_MAPPED_FILE_MMAP
+    if (_mapped)
+    {
+      munmap(const_cast<char*>(_data), _size);
+    }
+#endif
+    _data = nullptr;
+    _size = 0;
+    _mapped = false;
+    _buffer.clear();
+  }
+
+  // hint that the whole file will be read from front to back
+  void will_read_sequential() const
+  {
+#if defined(EH_MAPPED_FILE_MMAP) && defined(MADV_SEQUENTIAL)
+    if (_mapped)
+    {
+      madvise(const_cast<char*>(_data), _size, MADV_SEQUENTIAL);
+      madvise(const_cast<char*>(_data), _size, MADV_WILLNEED);
+    }
+#endif
+  }
+
+  // hint that pages will be touched in no particular order;
+  // turns off read-ahead of neighbor pages
+  void will_read_random() const
+  {
+#if defined(EH_MAPPED_FILE_MMAP) && defined(MADV_RANDOM)
+    if (_mapped)
+    {
+      madvise(const_cast<char*>(_data), _size, MADV_RANDOM);
+    }
+#endif
+  }
+  // hint that [offset, offset + bytes) will be read soon
+  void will_need(std::size_t offset, std::size_t bytes) const
+  {
+    advise(offset, bytes, true);
+  }
+  // drop pages in [offset, offset + bytes) from memory;
+  // they are read from the file again when touched
+  void dont_need(std::size_t offset, std::size_t bytes) const
+  {
+    advise(offset, bytes, false);
+  }
+
+  bool is_open() const
+  {
+    return _data != nullptr;
+  }
+  char const* data() const
+  {
+    return _data;
+  }
+  std::size_t size() const
+  {
+    return _size;
+  }
+};
+
+// size and modification time of a file, to tell if it has changed
+struct FileStamp
+{
+  std::uint64_t size = 0;
+  // nanoseconds since epoch
+  std::int64_t mtime = 0;
+
+  // all zero if the file does not exist
+  static FileStamp of(std::string const& filename)
+  {
+    FileStamp ret;
+#ifdef EH_MAPPED_FILE_MMAP
+    struct stat st;
+    if (stat(filename.c_str(), &st) != 0)
+    {
+      return ret;
+    }
+    ret.size = st.st_size;
+#if defined(__APPLE__)
+    ret.mtime = std::int64_t(st.st_mtimespec.tv_sec) * 1000000000
+                + st.st_mtimespec.tv_nsec;
+#else
+    ret.mtime = std::int64_t(st.st_mtim.tv_sec) * 1000000000
+                + st.st_mtim.tv_nsec;
+#endif
+#else
+    std::ifstream ifs(filename, std::ios::binary | std::ios::ate);
+    if (ifs)
+    {
+      ret.size = static_cast<std::uint64_t>(ifs.tellg());
+    }
+#endif
+    return ret;
+  }
+
+  bool operator==(FileStamp const& rhs) const
+  {
+    return size == rhs.size && mtime == rhs.mtime;
+  }
+  bool operator!=(FileStamp const& rhs) const
+  {
+    return !(*this == rhs);
+  }
+};
+
+}
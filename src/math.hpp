@@ -13,6 +13,8 @@ using vec2i = Eigen::Vector2i;
 using vec3i = Eigen::Vector3i;
 using vec4i = Eigen::Vector4i;
 
+using mat3 = Eigen::Matrix3f;
+
 inline vec3i vec3_to_color(vec3 c)
 {
   return (c.array().min(1.0f) * vec3(255.99f, 255.99f, 255.99f).array())
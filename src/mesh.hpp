@@ -0,0 +1,407 @@
+#pragma once
+
+#include "geometry.hpp"
+#include "math.hpp"
+#include "ray.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "parallel.hpp"
+#include "rtree_adapt.hpp"
+#include "simd_tree.hpp"
+#include "tree_layout.hpp"
+
+namespace eh
+{
+
+/*
+  indexed triangle mesh with its own (bottom-level) acceleration structure.
+
+  vertices are shared between triangles, and each triangle is 3 indices;
+  tree leaves hold triangle indices, not virtual GeometryObject.
+  the mesh is a single GeometryObject in World,
+  so the World's tree indexes only one bound for the whole mesh.
+  place it with MeshInstance to share one mesh between many copies.
+*/
+struct TriangleMesh : GeometryObject
+{
+  using rtree_type
+      = eh::rtree::RTree<BoundingBox, BoundingBox, std::uint32_t, 4, 8>;
+  using tree_type = SIMDTree<std::uint32_t, rtree_type::MAX_ENTRIES>;
+  using index_type = std::uint32_t;
+  using material_index_type = std::uint16_t;
+
+  struct face_t
+  {
+    index_type v[3];
+  };
+
+  // edges for Moller-Trumbore ray-triangle test;
+  // first corner p0 is not stored, it is in `positions`
+  struct record_t
+  {
+    // p1 - p0, p2 - p0
+    vec3 e1, e2;
+
+    record_t()
+    {
+    }
+    record_t(vec3 const& p0, vec3 const& p1, vec3 const& p2)
+        : e1(p1 - p0)
+        , e2(p2 - p0)
+    {
+    }
+
+    // Triangle::intersect(), hit is accepted if t < tmax
+    // only t and barycentric (u, v) are computed; no normal
+    bool intersect(vec3 const& p0,
+                   Ray const& r,
+                   float tmax,
+                   float& t,
+                   float& u,
+                   float& v) const
+    {
+      return Triangle::intersect(p0, e1, e2, r, tmax, t, u, v);
+    }
+
+    // ray nearly parallel to the plane of the triangle
+    bool grazing(Ray const& r) const
+    {
+      return Triangle::grazing(e1, e2, r);
+    }
+  };
+
+  // per-vertex position and normal
+  std::vector<vec3> positions;
+  std::vector<vec3> normals;
+  // per-triangle vertex indices
+  std::vector<face_t> faces;
+
+  // per-triangle index into `materials`;
+  // if empty, reflection model of the Object is used for all triangles
+  std::vector<material_index_type> material_ids;
+  std::vector<ReflectionModel const*> materials;
+
+  tree_type tree;
+  // node order of `tree`, and treelet size for TreeLayout::Treelet
+  TreeLayout layout = TreeLayout::DFS;
+  std::size_t treelet_bytes = 4096;
+  // keep record_t of each triangle, 24 bytes more per triangle;
+  // edges are computed from `positions` on each test if not set
+  bool precompute_records = false;
+  // per-triangle, in same order as `faces`; empty if not precomputed
+  std::vector<record_t> records;
+  BoundingBox bound = BoundingBox::empty();
+
+  TriangleMesh()
+  {
+  }
+  TriangleMesh(std::vector<Triangle> const& triangles)
+  {
+    assign(triangles);
+  }
+
+  // convert triangle soup to indexed mesh, merging vertices with
+  // exactly same position and normal, then build tree
+  void assign(std::vector<Triangle> const& triangles)
+  {
+    positions.clear();
+    normals.clear();
+    faces.clear();
+    material_ids.clear();
+    faces.reserve(triangles.size());
+
+    using key_type = std::array<float, 6>;
+    struct key_hash
+    {
+      std::size_t operator()(key_type const& key) const
+      {
+        std::uint64_t h = 0;
+        for (float f : key)
+        {
+          std::uint32_t bits;
+          // -0 and 0 compare equal, so must hash same
+          f += 0.0f;
+          std::memcpy(&bits, &f, sizeof(bits));
+          h = (h ^ bits) * 0x100000001b3ull;
+        }
+        return h ^ (h >> 32);
+      }
+    };
+    std::unordered_map<key_type, index_type, key_hash> vertex_map;
+    vertex_map.reserve(triangles.size() * 3);
+    const auto add_vertex = [&](vec3 const& p, vec3 const& n)
+    {
+      const key_type key { p.x(), p.y(), p.z(), n.x(), n.y(), n.z() };
+      auto it = vertex_map.emplace(key, positions.size());
+      if (it.second)
+      {
+        positions.push_back(p);
+        normals.push_back(n);
+      }
+      return it.first->second;
+    };
+    for (auto const& t : triangles)
+    {
+      face_t face;
+      face.v[0] = add_vertex(t.p0, t.n0);
+      face.v[1] = add_vertex(t.p1, t.n1);
+      face.v[2] = add_vertex(t.p2, t.n2);
+      faces.push_back(face);
+    }
+    build();
+  }
+
+  size_t size() const
+  {
+    return faces.size();
+  }
+  BoundingBox triangle_bound(index_type i) const
+  {
+    face_t const& f = faces[i];
+    BoundingBox ret;
+    ret.min_ = positions[f.v[0]]
+                   .cwiseMin(positions[f.v[1]])
+                   .cwiseMin(positions[f.v[2]]);
+    ret.max_ = positions[f.v[0]]
+                   .cwiseMax(positions[f.v[1]])
+                   .cwiseMax(positions[f.v[2]]);
+    return ret;
+  }
+
+  // rebuild tree; must be called after vertices or faces changed
+  // faces (and material_ids) are reordered as they are placed in leaves,
+  // so that triangles of a leaf are contiguous in memory
+  // thread_count: threads for bulk-loading tree and computing records
+  void build(unsigned int thread_count = std::thread::hardware_concurrency())
+  {
+    assert(material_ids.empty() || material_ids.size() == faces.size());
+    assert(std::all_of(material_ids.begin(), material_ids.end(),
+                       [&](material_index_type id)
+                       { return id < materials.size(); }));
+
+    std::vector<rtree_type::value_type> values;
+    values.reserve(faces.size());
+    bound = BoundingBox::empty();
+    for (index_type i = 0; i < faces.size(); ++i)
+    {
+      values.push_back({ triangle_bound(i), i });
+      bound = bound.merged(values.back().first);
+    }
+    rtree_type rtree;
+    rtree.bulk_load(values.begin(), values.end(), thread_count);
+    auto flat = rtree.flatten();
+    if (layout != TreeLayout::DFS)
+    {
+      flat = relayout(flat, layout,
+                      treelet_bytes / sizeof(tree_type::node_type));
+    }
+
+    std::vector<face_t> ordered_faces(faces.size());
+    std::vector<material_index_type> ordered_ids(material_ids.size());
+    for (index_type i = 0; i < flat.data.size(); ++i)
+    {
+      ordered_faces[i] = faces[flat.data[i]];
+      if (material_ids.empty() == false)
+      {
+        ordered_ids[i] = material_ids[flat.data[i]];
+      }
+      flat.data[i] = i;
+    }
+    faces.swap(ordered_faces);
+    material_ids.swap(ordered_ids);
+    tree.build(flat);
+
+    records.clear();
+    if (precompute_records == false)
+    {
+      return;
+    }
+    records.resize(faces.size());
+    parallel_for(
+        faces.size(),
+        [&](std::size_t i)
+        {
+          face_t const& f = faces[i];
+          records[i] = record_t(positions[f.v[0]], positions[f.v[1]],
+                                positions[f.v[2]]);
+        },
+        thread_count);
+  }
+
+  // record of i'th triangle; from `records` if precomputed
+  record_t record(index_type i) const
+  {
+    if (records.empty() == false)
+    {
+      return records[i];
+    }
+    face_t const& f = faces[i];
+    return record_t(positions[f.v[0]], positions[f.v[1]], positions[f.v[2]]);
+  }
+
+  RayHit raycast(Ray const& r) const override
+  {
+    RayHit ret = RayHit::no_hit();
+    // closest hit so far; shading is done only once for this
+    index_type hit_face = 0;
+    float hit_u = 0, hit_v = 0;
+    tree.raycast(r, ret,
+                 [&](index_type i, RayHit& cur)
+                 {
+                   const record_t rec = record(i);
+                   float t, u, v;
+                   if (rec.intersect(positions[faces[i].v[0]], r, cur.t, t, u,
+                                     v)
+                       && rec.grazing(r) == false)
+                   {
+                     cur.t = t;
+                     cur.surface = reinterpret_cast<Object const*>(1);
+                     hit_face = i;
+                     hit_u = u;
+                     hit_v = v;
+                   }
+                 },
+                 true);
+    if (ret.surface == nullptr)
+    {
+      return ret;
+    }
+
+    face_t const& f = faces[hit_face];
+    ret.normal = (normals[f.v[0]] + (normals[f.v[1]] - normals[f.v[0]]) * hit_u
+                  + (normals[f.v[2]] - normals[f.v[0]]) * hit_v)
+                     .normalized();
+    // interpolated normal can be perpendicular to the ray even where the
+    // face is not; face normal keeps the hit then
+    if (std::abs(ret.normal.dot(r.direction())) < EPSILON)
+    {
+      const record_t rec = record(hit_face);
+      ret.normal = rec.e1.cross(rec.e2).normalized();
+    }
+    if (material_ids.empty() == false)
+    {
+      ret.material = materials[material_ids[hit_face]];
+    }
+    return ret;
+  }
+  bool occluded(Ray const& r, float tmax) const override
+  {
+    return tree.occluded(r, tmax,
+                         [&](index_type i)
+                         {
+                           const record_t rec = record(i);
+                           float t, u, v;
+                           return rec.intersect(positions[faces[i].v[0]], r,
+                                                tmax, t, u, v)
+                                  && rec.grazing(r) == false;
+                         });
+  }
+  BoundingBox bounding_box() const override
+  {
+    return bound;
+  }
+};
+
+/*
+  placement of shared geometry (usually TriangleMesh) with affine transform
+
+  world = linear * object + translation
+
+  ray is transformed into object space and the hit is transformed back;
+  the geometry itself is never copied.
+*/
+struct MeshInstance : GeometryObject
+{
+  GeometryObject const* mesh = nullptr;
+
+  mat3 linear = mat3::Identity();
+  vec3 translation = vec3::Zero();
+
+  // cached from transform
+  mat3 inv_linear = mat3::Identity();
+  // inverse-transpose of linear, for normal vectors
+  mat3 normal_matrix = mat3::Identity();
+  BoundingBox bound = BoundingBox::empty();
+
+  MeshInstance()
+  {
+  }
+  MeshInstance(GeometryObject const* _mesh, vec3 const& _translation)
+      : mesh(_mesh)
+  {
+    set_transform(mat3::Identity(), _translation);
+  }
+  MeshInstance(GeometryObject const* _mesh,
+               mat3 const& _linear,
+               vec3 const& _translation)
+      : mesh(_mesh)
+  {
+    set_transform(_linear, _translation);
+  }
+
+  // `mesh` must be built before this, to get its bound
+  void set_transform(mat3 const& _linear, vec3 const& _translation)
+  {
+    linear = _linear;
+    translation = _translation;
+    inv_linear = linear.inverse();
+    normal_matrix = inv_linear.transpose();
+
+    // bound of 8 transformed corners
+    const BoundingBox b = mesh->bounding_box();
+    bound = BoundingBox::empty();
+    for (int i = 0; i < 8; ++i)
+    {
+      const vec3 corner((i & 1) ? b.max_.x() : b.min_.x(),
+                        (i & 2) ? b.max_.y() : b.min_.y(),
+                        (i & 4) ? b.max_.z() : b.min_.z());
+      bound = bound.merged(linear * corner + translation);
+    }
+  }
+
+  RayHit raycast(Ray const& r) const override
+  {
+    // direction is normalized again in object space;
+    // t is scaled back to world space by its length
+    const vec3 d = inv_linear * r.direction();
+    const float length = d.norm();
+    Ray local(inv_linear * (r.origin() - translation), d / length,
+              r.thread_id);
+    local.bounce = r.bounce;
+
+    RayHit ret = mesh->raycast(local);
+    if (ret.surface == nullptr)
+    {
+      return ret;
+    }
+    ret.t /= length;
+    ret.normal = (normal_matrix * ret.normal).normalized();
+    return ret;
+  }
+  bool occluded(Ray const& r, float tmax) const override
+  {
+    const vec3 d = inv_linear * r.direction();
+    const float length = d.norm();
+    Ray local(inv_linear * (r.origin() - translation), d / length,
+              r.thread_id);
+    local.bounce = r.bounce;
+    return mesh->occluded(local, tmax * length);
+  }
+  BoundingBox bounding_box() const override
+  {
+    return bound;
+  }
+};
+
+}
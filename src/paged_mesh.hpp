@@ -0,0 +1,697 @@
+#pragma once
+
+#include "geometry.hpp"
+#include "mapped_file.hpp"
+#include "math.hpp"
+#include "mesh.hpp"
+#include "ray.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace eh
+{
+
+/*
+  out-of-core triangle mesh
+
+  triangles are grouped into clusters of fixed size, written to a file,
+  and read through a memory mapping only when a ray reaches them.
+  only the tree over cluster bounds and a small table per cluster stay
+  resident; clusters are kept in memory up to a budget, and ones not used
+  recently are dropped from the mapping when it is exceeded.
+
+    PagedMesh::write("scene.paged", mesh);  // once, from a TriangleMesh
+    PagedMesh paged;
+    paged.open("scene.paged");
+    paged.set_budget(size_t(512) << 20);
+
+  per-triangle material ids of the mesh are kept in the clusters;
+  fill `materials` after open() as TriangleMesh::materials was,
+  material_count() entries, to have them set on hits.
+
+  dropping a cluster never invalidates it; a thread still reading it
+  gets its pages read from the file again. so the cache is shared by all
+  threads; a visit to a cached cluster only sets its reference bit,
+  and the lock is taken on a fault, to pick a victim by CLOCK.
+*/
+class PagedMesh : public GeometryObject
+{
+public:
+  using rtree_type
+      = eh::rtree::RTree<BoundingBox, BoundingBox, std::uint32_t, 4, 8>;
+  using tree_type = SIMDTree<std::uint32_t, rtree_type::MAX_ENTRIES>;
+  using index_type = std::uint32_t;
+  using record_t = TriangleMesh::record_t;
+  using material_index_type = TriangleMesh::material_index_type;
+
+  constexpr static std::uint32_t VERSION = 3;
+  // triangles tested together after one bound test, inside a cluster
+  constexpr static std::uint32_t GROUP_SIZE = 8;
+  constexpr static std::size_t DEFAULT_CLUSTER_BYTES = 4096;
+  constexpr static std::size_t DEFAULT_BUDGET_BYTES = std::size_t(256) << 20;
+
+  // bound of up to GROUP_SIZE consecutive triangles
+  struct group_t
+  {
+    float min_[3];
+    float max_[3];
+    std::uint32_t first;
+    std::uint32_t count;
+  };
+  // resident part of a cluster
+  struct cluster_t
+  {
+    float min_[3];
+    float max_[3];
+    std::uint32_t group_count;
+    std::uint32_t triangle_count;
+  };
+
+  /*
+    file layout, every part aligned to cluster_bytes:
+
+      header    : header_t
+      table     : cluster_t per cluster
+      clusters  : cluster_bytes each;
+                  groups, then first corner and record per triangle,
+                  then 3 vertex normals per triangle, then material ids
+  */
+  struct header_t
+  {
+    char magic[8];
+    std::uint32_t version;
+    std::uint32_t cluster_bytes;
+    std::uint64_t cluster_count;
+    std::uint64_t triangle_count;
+    std::uint64_t table_offset;
+    std::uint64_t clusters_offset;
+    // size of materials the ids refer to; 0 if the mesh had no ids
+    std::uint64_t material_count;
+  };
+
+  struct paging_stats_t
+  {
+    // clusters found in the cache
+    std::uint64_t hits = 0;
+    // clusters read from the file
+    std::uint64_t faults = 0;
+    // clusters dropped to stay in budget
+    std::uint64_t evictions = 0;
+  };
+
+protected:
+  // bits of per-cluster state
+  constexpr static std::uint8_t CACHED = 1;
+  constexpr static std::uint8_t REFERENCED = 2;
+  // hit counters are spread over cache lines, one per group of threads
+  constexpr static unsigned HIT_COUNTERS = 16;
+
+  struct alignas(64) hit_counter_t
+  {
+    std::atomic<std::uint64_t> count { 0 };
+  };
+
+  MappedFile _file;
+  header_t _header;
+  std::vector<cluster_t> _clusters;
+  tree_type _tree;
+  BoundingBox _bound = BoundingBox::empty();
+
+  // CLOCK over cached clusters; _slots and _hand are guarded by _mutex,
+  // _state is read and marked referenced without it
+  mutable std::mutex _mutex;
+  mutable std::vector<std::atomic<std::uint8_t>> _state;
+  mutable std::vector<index_type> _slots;
+  mutable std::size_t _hand = 0;
+  std::size_t _budget_bytes = DEFAULT_BUDGET_BYTES;
+  std::size_t _budget_clusters = 1;
+  // faults and evictions; hits are in _hits
+  mutable paging_stats_t _stats;
+  mutable hit_counter_t _hits[HIT_COUNTERS];
+
+  static void set_magic(char (&m)[8])
+  {
+    std::memcpy(m, "EHPAGED\1", 8);
+  }
+
+  // groups per cluster of given size
+  static std::uint32_t group_capacity(std::size_t cluster_bytes)
+  {
+    return cluster_bytes
+           / (sizeof(group_t)
+              + GROUP_SIZE
+                    * (sizeof(record_t) + 4 * sizeof(vec3)
+                       + sizeof(material_index_type)));
+  }
+  static std::size_t align(std::size_t offset, std::size_t alignment)
+  {
+    return (offset + alignment - 1) / alignment * alignment;
+  }
+  // clusters are dropped by whole pages, so must be made of them
+  static bool valid_cluster_bytes(std::size_t cluster_bytes)
+  {
+    return group_capacity(cluster_bytes) > 0
+           && cluster_bytes % MappedFile::page_size() == 0
+           && cluster_bytes <= std::numeric_limits<std::uint32_t>::max();
+  }
+
+  std::size_t cluster_offset(index_type c) const
+  {
+    return _header.clusters_offset + std::size_t(c) * _header.cluster_bytes;
+  }
+
+  static unsigned hit_counter_index()
+  {
+    static std::atomic<unsigned> next { 0 };
+    thread_local const unsigned index = next++ % HIT_COUNTERS;
+    return index;
+  }
+
+  // frees one slot; the hand passes over clusters referenced since it
+  // last came, clearing their bit, and drops the first one that was not
+  std::size_t evict_one() const
+  {
+    while (true)
+    {
+      if (_hand >= _slots.size())
+      {
+        _hand = 0;
+      }
+      const index_type c = _slots[_hand];
+      if (_state[c].fetch_and(~REFERENCED, std::memory_order_relaxed)
+          & REFERENCED)
+      {
+        ++_hand;
+        continue;
+      }
+      _state[c].store(0, std::memory_order_relaxed);
+      ++_stats.evictions;
+      _file.dont_need(cluster_offset(c), _header.cluster_bytes);
+      return _hand++;
+    }
+  }
+  void evict_to(std::size_t count) const
+  {
+    while (_slots.size() > count)
+    {
+      const std::size_t s = evict_one();
+      _slots[s] = _slots.back();
+      _slots.pop_back();
+    }
+  }
+
+  // groups of cluster `c` cover only its triangles; read on a fault,
+  // as the table in open() can not be checked without reading every cluster
+  bool valid_groups(index_type c, char const* data) const
+  {
+    group_t const* groups = reinterpret_cast<group_t const*>(data);
+    const std::uint32_t triangles = _clusters[c].triangle_count;
+    for (std::uint32_t g = 0; g < _clusters[c].group_count; ++g)
+    {
+      if (groups[g].first > triangles
+          || groups[g].count > triangles - groups[g].first)
+      {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  // cluster `c` in memory, marked as referenced;
+  // nullptr if its groups are corrupt, then it is never cached
+  char const* fetch(index_type c) const
+  {
+    const std::uint8_t state = _state[c].load(std::memory_order_relaxed);
+    if (state & CACHED)
+    {
+      if ((state & REFERENCED) == 0)
+      {
+        _state[c].fetch_or(REFERENCED, std::memory_order_relaxed);
+      }
+      _hits[hit_counter_index()].count.fetch_add(1,
+                                                 std::memory_order_relaxed);
+    }
+    else
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+      // other thread may have read it meanwhile
+      if (_state[c].load(std::memory_order_relaxed) & CACHED)
+      {
+        _state[c].fetch_or(REFERENCED, std::memory_order_relaxed);
+        _hits[hit_counter_index()].count.fetch_add(1,
+                                                   std::memory_order_relaxed);
+      }
+      else
+      {
+        ++_stats.faults;
+        if (valid_groups(c, _file.data() + cluster_offset(c)) == false)
+        {
+          return nullptr;
+        }
+        if (_slots.size() < _budget_clusters)
+        {
+          _slots.push_back(c);
+        }
+        else
+        {
+          _slots[evict_one()] = c;
+        }
+        _state[c].store(CACHED | REFERENCED, std::memory_order_relaxed);
+        _file.will_need(cluster_offset(c), _header.cluster_bytes);
+      }
+    }
+    return _file.data() + cluster_offset(c);
+  }
+
+  // offsets of the arrays in a cluster of `capacity` groups
+  struct cluster_layout_t
+  {
+    std::size_t corners;
+    std::size_t records;
+    std::size_t normals;
+    std::size_t material_ids;
+
+    cluster_layout_t(std::uint32_t capacity)
+    {
+      const std::size_t triangles = std::size_t(capacity) * GROUP_SIZE;
+      corners = capacity * sizeof(group_t);
+      records = corners + triangles * sizeof(vec3);
+      normals = records + triangles * sizeof(record_t);
+      material_ids = normals + 3 * triangles * sizeof(vec3);
+    }
+  };
+  struct cluster_view_t
+  {
+    group_t const* groups;
+    // p0 of each triangle, for record_t::intersect()
+    vec3 const* corners;
+    record_t const* records;
+    vec3 const* normals;
+    material_index_type const* material_ids;
+  };
+  cluster_view_t view(char const* data) const
+  {
+    const cluster_layout_t layout(group_capacity(_header.cluster_bytes));
+    cluster_view_t ret;
+    ret.groups = reinterpret_cast<group_t const*>(data);
+    ret.corners = reinterpret_cast<vec3 const*>(data + layout.corners);
+    ret.records = reinterpret_cast<record_t const*>(data + layout.records);
+    ret.normals = reinterpret_cast<vec3 const*>(data + layout.normals);
+    ret.material_ids = reinterpret_cast<material_index_type const*>(
+        data + layout.material_ids);
+    return ret;
+  }
+
+  static bool
+  group_hit(group_t const& g, Ray const& r, float tmax, float& tmin)
+  {
+    BoundingBox b;
+    b.min_ = vec3(g.min_[0], g.min_[1], g.min_[2]);
+    b.max_ = vec3(g.max_[0], g.max_[1], g.max_[2]);
+    float t1;
+    return b.raycast(r, tmin, t1) && tmin < tmax;
+  }
+
+public:
+  // indexed by material ids of the triangles; see material_count()
+  std::vector<ReflectionModel const*> materials;
+
+  PagedMesh()
+  {
+    std::memset(&_header, 0, sizeof(_header));
+  }
+
+  // write triangles of `mesh` into `filename` as clusters;
+  // faces are taken in order, so a built mesh gives compact clusters.
+  // returns false if cluster_bytes is not a multiple of the page size
+  static bool write(std::string const& filename,
+                    TriangleMesh const& mesh,
+                    std::size_t cluster_bytes = DEFAULT_CLUSTER_BYTES)
+  {
+    if (valid_cluster_bytes(cluster_bytes) == false)
+    {
+      return false;
+    }
+    const std::uint32_t capacity = group_capacity(cluster_bytes);
+    const cluster_layout_t layout(capacity);
+    const std::size_t cluster_triangles = capacity * GROUP_SIZE;
+    const std::size_t face_count = mesh.faces.size();
+    const std::size_t cluster_count
+        = (face_count + cluster_triangles - 1) / cluster_triangles;
+
+    header_t header;
+    std::memset(&header, 0, sizeof(header));
+    set_magic(header.magic);
+    header.version = VERSION;
+    header.cluster_bytes = cluster_bytes;
+    header.cluster_count = cluster_count;
+    header.triangle_count = face_count;
+    header.table_offset = align(sizeof(header_t), cluster_bytes);
+    header.clusters_offset = align(
+        header.table_offset + cluster_count * sizeof(cluster_t), cluster_bytes);
+    header.material_count
+        = mesh.material_ids.empty() ? 0 : mesh.materials.size();
+
+    std::vector<cluster_t> table(cluster_count);
+    std::vector<char> buffer(cluster_bytes);
+    const std::string temp = filename + ".tmp";
+    {
+      std::ofstream ofs(temp, std::ios::binary | std::ios::trunc);
+      if (!ofs)
+      {
+        return false;
+      }
+      // header and table are written last, once table is filled
+      ofs.seekp(header.clusters_offset);
+      for (std::size_t c = 0; c < cluster_count; ++c)
+      {
+        std::fill(buffer.begin(), buffer.end(), 0);
+        group_t* groups = reinterpret_cast<group_t*>(buffer.data());
+        vec3* corners = reinterpret_cast<vec3*>(buffer.data() + layout.corners);
+        record_t* records
+            = reinterpret_cast<record_t*>(buffer.data() + layout.records);
+        vec3* normals = reinterpret_cast<vec3*>(buffer.data() + layout.normals);
+        material_index_type* material_ids
+            = reinterpret_cast<material_index_type*>(buffer.data()
+                                                     + layout.material_ids);
+
+        const std::size_t first = c * cluster_triangles;
+        const std::size_t count
+            = std::min(cluster_triangles, face_count - first);
+        BoundingBox cluster_bound = BoundingBox::empty();
+        BoundingBox group_bound = BoundingBox::empty();
+        for (std::size_t i = 0; i < count; ++i)
+        {
+          TriangleMesh::face_t const& f = mesh.faces[first + i];
+          const BoundingBox b = mesh.triangle_bound(first + i);
+          group_bound = group_bound.merged(b);
+          corners[i] = mesh.positions[f.v[0]];
+          records[i] = record_t(mesh.positions[f.v[0]], mesh.positions[f.v[1]],
+                                mesh.positions[f.v[2]]);
+          for (int k = 0; k < 3; ++k)
+          {
+            normals[3 * i + k] = mesh.normals[f.v[k]];
+          }
+          if (mesh.material_ids.empty() == false)
+          {
+            material_ids[i] = mesh.material_ids[first + i];
+          }
+          if (i % GROUP_SIZE == GROUP_SIZE - 1 || i + 1 == count)
+          {
+            group_t& g = groups[i / GROUP_SIZE];
+            g.first = i / GROUP_SIZE * GROUP_SIZE;
+            g.count = i + 1 - g.first;
+            for (int a = 0; a < 3; ++a)
+            {
+              g.min_[a] = group_bound.min_[a];
+              g.max_[a] = group_bound.max_[a];
+            }
+            cluster_bound = cluster_bound.merged(group_bound);
+            group_bound = BoundingBox::empty();
+          }
+        }
+        cluster_t& info = table[c];
+        info.group_count = (count + GROUP_SIZE - 1) / GROUP_SIZE;
+        info.triangle_count = count;
+        for (int a = 0; a < 3; ++a)
+        {
+          info.min_[a] = cluster_bound.min_[a];
+          info.max_[a] = cluster_bound.max_[a];
+        }
+        ofs.write(buffer.data(), cluster_bytes);
+      }
+      ofs.seekp(0);
+      ofs.write(reinterpret_cast<char const*>(&header), sizeof(header));
+      ofs.seekp(header.table_offset);
+      ofs.write(reinterpret_cast<char const*>(table.data()),
+                table.size() * sizeof(cluster_t));
+      if (!ofs)
+      {
+        std::remove(temp.c_str());
+        return false;
+      }
+    }
+    return std::rename(temp.c_str(), filename.c_str()) == 0;
+  }
+
+  // map file written by write(), and build the tree over its clusters;
+  // returns false if the file is missing or not valid
+  bool open(std::string const& filename)
+  {
+    close();
+    if (_file.open(filename) == false || _file.size() < sizeof(header_t))
+    {
+      _file.close();
+      return false;
+    }
+    header_t header;
+    std::memcpy(&header, _file.data(), sizeof(header));
+    char magic[8];
+    set_magic(magic);
+    // sizes are compared by division, which can not overflow
+    const std::uint64_t file_size = _file.size();
+    if (std::memcmp(header.magic, magic, sizeof(magic)) != 0
+        || header.version != VERSION
+        || valid_cluster_bytes(header.cluster_bytes) == false
+        || header.cluster_count >= std::numeric_limits<index_type>::max()
+        || header.table_offset > file_size
+        || header.cluster_count
+               > (file_size - header.table_offset) / sizeof(cluster_t)
+        || header.clusters_offset > file_size
+        || header.cluster_count
+               > (file_size - header.clusters_offset) / header.cluster_bytes)
+    {
+      _file.close();
+      return false;
+    }
+    _clusters.resize(header.cluster_count);
+    std::memcpy(_clusters.data(), _file.data() + header.table_offset,
+                _clusters.size() * sizeof(cluster_t));
+    // table must fit in clusters and add up to the header
+    const std::uint32_t capacity = group_capacity(header.cluster_bytes);
+    std::uint64_t triangle_count = 0;
+    for (cluster_t const& info : _clusters)
+    {
+      if (info.group_count > capacity
+          || info.triangle_count > std::uint64_t(capacity) * GROUP_SIZE)
+      {
+        close();
+        return false;
+      }
+      triangle_count += info.triangle_count;
+    }
+    if (triangle_count != header.triangle_count)
+    {
+      close();
+      return false;
+    }
+    _header = header;
+    // clusters are touched in the order rays reach them
+    _file.will_read_random();
+    _file.dont_need(0, header.clusters_offset);
+
+    std::vector<rtree_type::value_type> values;
+    values.reserve(_clusters.size());
+    for (index_type c = 0; c < _clusters.size(); ++c)
+    {
+      BoundingBox b;
+      b.min_ = vec3(_clusters[c].min_[0], _clusters[c].min_[1],
+                    _clusters[c].min_[2]);
+      b.max_ = vec3(_clusters[c].max_[0], _clusters[c].max_[1],
+                    _clusters[c].max_[2]);
+      values.push_back({ b, c });
+      _bound = _bound.merged(b);
+    }
+    rtree_type rtree;
+    rtree.bulk_load(values.begin(), values.end());
+    _tree.build(rtree.flatten());
+
+    _state = std::vector<std::atomic<std::uint8_t>>(_clusters.size());
+    set_budget(_budget_bytes);
+    return true;
+  }
+  void close()
+  {
+    _file.close();
+    _clusters.clear();
+    _tree.clear();
+    _bound = BoundingBox::empty();
+    _state.clear();
+    _slots.clear();
+    _hand = 0;
+    std::memset(&_header, 0, sizeof(_header));
+  }
+
+  // memory for clusters in the cache; at least one cluster is kept.
+  // takes effect at once if the file is open
+  void set_budget(std::size_t bytes)
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _budget_bytes = bytes;
+    const std::size_t cluster_bytes
+        = _header.cluster_bytes ? _header.cluster_bytes : DEFAULT_CLUSTER_BYTES;
+    _budget_clusters = std::max<std::size_t>(1, bytes / cluster_bytes);
+    evict_to(_budget_clusters);
+  }
+  std::size_t budget_bytes() const
+  {
+    return _budget_bytes;
+  }
+  // bytes of clusters in the cache now
+  std::size_t cached_bytes() const
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _slots.size() * _header.cluster_bytes;
+  }
+  // bytes of all clusters, as in the file
+  std::size_t cluster_bytes() const
+  {
+    return _clusters.size() * std::size_t(_header.cluster_bytes);
+  }
+  std::size_t cluster_count() const
+  {
+    return _clusters.size();
+  }
+  std::size_t size() const
+  {
+    return _header.triangle_count;
+  }
+  // entries `materials` should have; 0 if triangles have no material ids
+  std::size_t material_count() const
+  {
+    return _header.material_count;
+  }
+
+  paging_stats_t stats() const
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    paging_stats_t ret = _stats;
+    for (hit_counter_t const& h : _hits)
+    {
+      ret.hits += h.count.load(std::memory_order_relaxed);
+    }
+    return ret;
+  }
+  void reset_stats()
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _stats = paging_stats_t();
+    for (hit_counter_t& h : _hits)
+    {
+      h.count.store(0, std::memory_order_relaxed);
+    }
+  }
+  // drop every cached cluster, e.g. to measure from a cold cache
+  void drop_cache()
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    evict_to(0);
+  }
+
+  RayHit raycast(Ray const& r) const override
+  {
+    RayHit ret = RayHit::no_hit();
+    _tree.raycast(
+        r, ret,
+        [&](index_type c, RayHit& cur)
+        {
+          char const* data = fetch(c);
+          if (data == nullptr)
+          {
+            return;
+          }
+          const cluster_view_t v = view(data);
+          for (std::uint32_t g = 0; g < _clusters[c].group_count; ++g)
+          {
+            group_t const& group = v.groups[g];
+            float tmin;
+            if (group_hit(group, r, cur.t, tmin) == false)
+            {
+              continue;
+            }
+            for (index_type i = group.first; i < group.first + group.count;
+                 ++i)
+            {
+              float t, u, w;
+              if (v.records[i].intersect(v.corners[i], r, cur.t, t, u, w)
+                  && v.records[i].grazing(r) == false)
+              {
+                // normal now, while the cluster is surely in the cache
+                vec3 const* n = v.normals + 3 * i;
+                cur.t = t;
+                cur.surface = reinterpret_cast<Object const*>(1);
+                cur.normal
+                    = (n[0] + (n[1] - n[0]) * u + (n[2] - n[0]) * w)
+                          .normalized();
+                // same as TriangleMesh::raycast()
+                if (std::abs(cur.normal.dot(r.direction())) < EPSILON)
+                {
+                  cur.normal
+                      = v.records[i].e1.cross(v.records[i].e2).normalized();
+                }
+                // ids from the file are not trusted; reflection model of
+                // the Object is used for one out of `materials`
+                cur.material = nullptr;
+                if (_header.material_count != 0
+                    && v.material_ids[i] < materials.size())
+                {
+                  cur.material = materials[v.material_ids[i]];
+                }
+              }
+            }
+          }
+        },
+        true);
+    return ret;
+  }
+  bool occluded(Ray const& r, float tmax) const override
+  {
+    return _tree.occluded(
+        r, tmax,
+        [&](index_type c)
+        {
+          char const* data = fetch(c);
+          if (data == nullptr)
+          {
+            return false;
+          }
+          const cluster_view_t v = view(data);
+          for (std::uint32_t g = 0; g < _clusters[c].group_count; ++g)
+          {
+            group_t const& group = v.groups[g];
+            float tmin;
+            if (group_hit(group, r, tmax, tmin) == false)
+            {
+              continue;
+            }
+            for (index_type i = group.first; i < group.first + group.count;
+                 ++i)
+            {
+              float t, u, w;
+              if (v.records[i].intersect(v.corners[i], r, tmax, t, u, w)
+                  && v.records[i].grazing(r) == false)
+              {
+                return true;
+              }
+            }
+          }
+          return false;
+        });
+  }
+  BoundingBox bounding_box() const override
+  {
+    return _bound;
+  }
+};
+
+}
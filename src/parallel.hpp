@@ -0,0 +1,86 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace eh
+{
+
+// split [0, count) into contiguous chunks over `thread_count` threads,
+// and run functor(thread_index, begin, end) for each chunk.
+// the calling thread takes the first chunk; returns after all are done.
+template <typename Functor>
+void parallel_chunks(std::size_t count,
+                     Functor functor,
+                     unsigned int thread_count
+                     = std::thread::hardware_concurrency())
+{
+  // not worth spawning threads for small ranges
+  constexpr std::size_t MIN_CHUNK = 64;
+
+  thread_count = std::max(1u, thread_count);
+  thread_count = std::min<std::size_t>(
+      thread_count, std::max<std::size_t>(1, count / MIN_CHUNK));
+
+  if (thread_count == 1)
+  {
+    functor(0u, std::size_t(0), count);
+    return;
+  }
+
+  const std::size_t chunk = (count + thread_count - 1) / thread_count;
+  std::vector<std::thread> threads;
+  threads.reserve(thread_count - 1);
+  for (unsigned int t = 1; t < thread_count; ++t)
+  {
+    const std::size_t begin = std::min(count, t * chunk);
+    const std::size_t end = std::min(count, begin + chunk);
+    threads.emplace_back(functor, t, begin, end);
+  }
+  functor(0u, std::size_t(0), std::min(count, chunk));
+  for (auto& t : threads)
+  {
+    t.join();
+  }
+}
+
+// run functor(i) for every i in [0, count), split as parallel_chunks()
+template <typename Functor>
+void parallel_for(std::size_t count,
+                  Functor functor,
+                  unsigned int thread_count
+                  = std::thread::hardware_concurrency())
+{
+  parallel_chunks(
+      count,
+      [&](unsigned int, std::size_t begin, std::size_t end)
+      {
+        for (std::size_t i = begin; i < end; ++i)
+        {
+          functor(i);
+        }
+      },
+      thread_count);
+}
+
+// run a() and b() concurrently, a() on a new thread, if thread_count > 1;
+// otherwise one after another. returns after both are done.
+// for fork-join recursion, give each side half of thread_count
+template <typename FunctorA, typename FunctorB>
+void parallel_invoke(FunctorA&& a, FunctorB&& b, unsigned int thread_count)
+{
+  if (thread_count <= 1)
+  {
+    a();
+    b();
+    return;
+  }
+  std::thread thread(std::forward<FunctorA>(a));
+  b();
+  thread.join();
+}
+
+}
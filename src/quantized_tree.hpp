@@ -0,0 +1,326 @@
+#pragma once
+
+#include "geometry.hpp"
+#include "ray.hpp"
+#include "simd_tree.hpp"
+
+#include <cassert>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <type_traits>
+#include <vector>
+
+namespace eh
+{
+
+/*
+  frozen R-tree node with children bounds quantized relative to node bound.
+
+  each coordinate of children is stored as an integer grid index of
+  QuantType (8 or 16 bits) over the node's own bound:
+
+    value = origin + q * scale
+
+  min point is rounded down and max point is rounded up, so the decoded box
+  always encloses the original one; coarse grid only costs extra visits,
+  never a missed hit.
+
+  children with non-finite bound (e.g. Plane) cannot be put on the grid;
+  they are flagged in `unbounded` and decoded as infinite box.
+*/
+template <typename QuantType, unsigned int Width>
+struct quantized_node_t
+{
+  static_assert(std::is_unsigned<QuantType>::value,
+                "QuantType must be unsigned integer");
+
+  constexpr static QuantType QMAX = std::numeric_limits<QuantType>::max();
+
+  float origin[3];
+  float scale[3];
+
+  QuantType min_[3][Width];
+  QuantType max_[3][Width];
+
+  // child node index, or data index if this is leaf node
+  std::uint32_t children[Width];
+
+  // the number of children
+  std::uint8_t size;
+  bool leaf;
+  // bitmask of children with non-finite bound
+  std::uint16_t unbounded;
+
+  static float dequantize(float origin, float scale, QuantType q)
+  {
+    return origin + static_cast<float>(q) * scale;
+  }
+
+  // write float bounds of children to `out` for simd_raycast()
+  void decode(simd_node_t<Width>& out) const
+  {
+    for (int a = 0; a < 3; ++a)
+    {
+      for (unsigned int i = 0; i < Width; ++i)
+      {
+        out.min_[a][i] = dequantize(origin[a], scale[a], min_[a][i]);
+        out.max_[a][i] = dequantize(origin[a], scale[a], max_[a][i]);
+      }
+    }
+    for (unsigned int mask = unbounded; mask; mask &= mask - 1)
+    {
+      const int i = __builtin_ctz(mask);
+      for (int a = 0; a < 3; ++a)
+      {
+        out.min_[a][i] = -std::numeric_limits<float>::infinity();
+        out.max_[a][i] = std::numeric_limits<float>::infinity();
+      }
+    }
+    out.size = size;
+    out.leaf = leaf;
+  }
+};
+
+// read-only R-tree made of quantized_node_t, built from RTree::flatten() result
+template <typename MappedType,
+          typename QuantType = std::uint8_t,
+          unsigned int Width = 8>
+class QuantizedTree
+{
+public:
+  using mapped_type = MappedType;
+  using node_type = quantized_node_t<QuantType, Width>;
+  using size_type = std::uint32_t;
+
+  static_assert(Width <= 16, "unbounded mask holds 16 children");
+
+protected:
+  std::vector<node_type> _nodes;
+  std::vector<mapped_type> _data;
+
+  // set grid of `dst` to cover finite children in [first, first+size)
+  static void build_grid(node_type& dst,
+                         BoundingBox const* first,
+                         size_type size)
+  {
+    BoundingBox bound = BoundingBox::empty();
+    for (size_type i = 0; i < size; ++i)
+    {
+      if (first[i].is_finite())
+      {
+        bound = bound.merged(first[i]);
+      }
+    }
+    for (int a = 0; a < 3; ++a)
+    {
+      if (bound.min_[a] > bound.max_[a])
+      {
+        // no finite children
+        dst.origin[a] = 0;
+        dst.scale[a] = 0;
+        continue;
+      }
+      dst.origin[a] = bound.min_[a];
+      float scale = (bound.max_[a] - bound.min_[a]) / node_type::QMAX;
+      // last grid point must not fall short of the bound
+      while (node_type::dequantize(dst.origin[a], scale, node_type::QMAX)
+             < bound.max_[a])
+      {
+        scale = std::nextafter(scale, std::numeric_limits<float>::max());
+      }
+      dst.scale[a] = scale;
+    }
+  }
+
+  static QuantType quantize_down(float origin, float scale, float v)
+  {
+    if (scale == 0)
+    {
+      return 0;
+    }
+    float q = std::floor((v - origin) / scale);
+    q = std::min(std::max(q, 0.0f), static_cast<float>(node_type::QMAX));
+    QuantType ret = static_cast<QuantType>(q);
+    while (ret > 0 && node_type::dequantize(origin, scale, ret) > v)
+    {
+      --ret;
+    }
+    return ret;
+  }
+  static QuantType quantize_up(float origin, float scale, float v)
+  {
+    if (scale == 0)
+    {
+      return 0;
+    }
+    float q = std::ceil((v - origin) / scale);
+    q = std::min(std::max(q, 0.0f), static_cast<float>(node_type::QMAX));
+    QuantType ret = static_cast<QuantType>(q);
+    while (ret < node_type::QMAX
+           && node_type::dequantize(origin, scale, ret) < v)
+    {
+      ++ret;
+    }
+    return ret;
+  }
+
+public:
+  // node indices are kept same as in flatten result
+  template <typename FlattenResult>
+  void build(FlattenResult const& tree)
+  {
+    _data = tree.data;
+    _nodes.clear();
+    _nodes.resize(tree.nodes.size());
+
+    // level of each node, to find out leaf nodes
+    std::vector<size_type> level(tree.nodes.size(), 0);
+    for (size_type n = 0; n < tree.nodes.size(); ++n)
+    {
+      auto const& src = tree.nodes[n];
+      node_type& dst = _nodes[n];
+      assert(src.size <= Width);
+
+      BoundingBox const* bounds = tree.children_bound.data() + src.offset;
+      build_grid(dst, bounds, src.size);
+      dst.size = src.size;
+      dst.leaf = level[n] == tree.leaf_level;
+      dst.unbounded = 0;
+      for (size_type i = 0; i < Width; ++i)
+      {
+        dst.children[i] = 0;
+        for (int a = 0; a < 3; ++a)
+        {
+          dst.min_[a][i] = 0;
+          dst.max_[a][i] = 0;
+        }
+        if (i >= src.size)
+        {
+          // unused lanes are masked out in simd_raycast()
+          continue;
+        }
+        dst.children[i] = tree.children[src.offset + i];
+        if (dst.leaf == false)
+        {
+          level[dst.children[i]] = level[n] + 1;
+        }
+        if (bounds[i].is_finite() == false)
+        {
+          dst.unbounded |= 1u << i;
+          continue;
+        }
+        for (int a = 0; a < 3; ++a)
+        {
+          dst.min_[a][i]
+              = quantize_down(dst.origin[a], dst.scale[a], bounds[i].min_[a]);
+          dst.max_[a][i]
+              = quantize_up(dst.origin[a], dst.scale[a], bounds[i].max_[a]);
+        }
+      }
+    }
+  }
+
+  void clear()
+  {
+    _nodes.clear();
+    _data.clear();
+  }
+
+  std::vector<node_type> const& nodes() const
+  {
+    return _nodes;
+  }
+  std::vector<mapped_type> const& data() const
+  {
+    return _data;
+  }
+
+protected:
+  // children of node `index` hit before tmax, for stack_raycast();
+  // bounds are decoded to float and tested as in SIMDTree
+  template <typename Visit>
+  bool visit_children(size_type index,
+                      simd_ray_t const& ray,
+                      float const& tmax,
+                      bool reverse,
+                      TraversalStats* stats,
+                      Visit visit) const
+  {
+    node_type const& node = _nodes[index];
+    if (stats)
+    {
+      stats->visit_node(&node, sizeof(node));
+    }
+    simd_node_t<Width> decoded;
+    node.decode(decoded);
+    return simd_visit_children(decoded, ray, tmax, reverse, visit);
+  }
+  mapped_type const&
+  visit_data(size_type index, int i, TraversalStats* stats) const
+  {
+    mapped_type const& data = _data[_nodes[index].children[i]];
+    if (stats)
+    {
+      stats->visit_primitive(&data, sizeof(mapped_type));
+    }
+    return data;
+  }
+
+public:
+
+  // any-hit traversal; returns true as soon as functor returns true
+  // functor( mapped_type const& ) tests if ray hits the data before tmax
+  template <typename Functor>
+  bool occluded(Ray const& ray,
+                float tmax,
+                Functor functor,
+                TraversalStats* stats = nullptr) const
+  {
+    if (_nodes.empty())
+    {
+      return false;
+    }
+    const simd_ray_t simd_ray(ray);
+    return stack_occluded(
+        size_type(0), tmax,
+        [&](size_type index) { return _nodes[index].leaf; },
+        [&](size_type index, float const& t, bool reverse, auto visit)
+        {
+          return visit_children(index, simd_ray, t, reverse, stats, visit);
+        },
+        [&](size_type index, int i) { return _nodes[index].children[i]; },
+        [&](size_type index, int i)
+        { return functor(visit_data(index, i, stats)); });
+  }
+
+  // closest-hit traversal
+  // functor( mapped_type const&, RayHit& cur ) tests ray against the data
+  // and updates `cur` if closer hit was found
+  // ordered: visit children front-to-back by their entry distance
+  template <typename Functor>
+  void raycast(Ray const& ray,
+               RayHit& cur,
+               Functor functor,
+               bool ordered = false,
+               TraversalStats* stats = nullptr) const
+  {
+    if (_nodes.empty())
+    {
+      return;
+    }
+    const simd_ray_t simd_ray(ray);
+    stack_raycast(
+        size_type(0), cur, ordered,
+        [&](size_type index) { return _nodes[index].leaf; },
+        [&](size_type index, float const& t, bool reverse, auto visit)
+        {
+          return visit_children(index, simd_ray, t, reverse, stats, visit);
+        },
+        [&](size_type index, int i) { return _nodes[index].children[i]; },
+        [&](size_type index, int i, RayHit& hit)
+        { functor(visit_data(index, i, stats), hit); });
+  }
+};
+
+}
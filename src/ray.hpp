@@ -1,8 +1,11 @@
 #pragma once
 
+#include "cache_simulator.hpp"
 #include "global.hpp"
 #include "math.hpp"
 #include <cassert>
+#include <cstddef>
+#include <cstdint>
 #include <limits>
 
 namespace eh
@@ -54,6 +57,9 @@ struct RayHit
   Object const* surface = nullptr;
   // normal vector at hit surface, |normal|=1
   vec3 normal;
+  // material of hit primitive, if the geometry has its own;
+  // otherwise surface->reflect is used
+  ReflectionModel const* material = nullptr;
 
   vec3 point(Ray const& r) const
   {
@@ -68,8 +74,51 @@ struct RayHit
     RayHit ret;
     ret.t = std::numeric_limits<float>::infinity();
     ret.surface = nullptr;
+    ret.material = nullptr;
     return ret;
   }
 };
 
+// counters for acceleration structure traversal
+struct TraversalStats
+{
+  // visited nodes, including leaf nodes
+  std::uint64_t nodes = 0;
+  // primitives tested against ray
+  std::uint64_t primitives = 0;
+  // cache lines missed in `cache` on node and primitive fetches
+  std::uint64_t cache_misses = 0;
+
+  CacheSimulator cache;
+
+  void visit_node(void const* p, std::size_t bytes)
+  {
+    ++nodes;
+    cache_misses += cache.access(p, bytes);
+  }
+  void visit_primitive(void const* p, std::size_t bytes)
+  {
+    ++primitives;
+    cache_misses += cache.access(p, bytes);
+  }
+
+  // zero counters and empty the cache; cache size is kept
+  void reset()
+  {
+    nodes = 0;
+    primitives = 0;
+    cache_misses = 0;
+    cache.clear();
+  }
+
+  // sums counters only
+  TraversalStats& operator+=(TraversalStats const& rhs)
+  {
+    nodes += rhs.nodes;
+    primitives += rhs.primitives;
+    cache_misses += rhs.cache_misses;
+    return *this;
+  }
+};
+
 }
@@ -0,0 +1,87 @@
+#pragma once
+
+#include "geometry.hpp"
+#include "math.hpp"
+#include "ray.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+namespace eh
+{
+
+// spread lower 10 bits of v to every third bit
+inline std::uint32_t morton_spread(std::uint32_t v)
+{
+  v &= 0x3ff;
+  v = (v | (v << 16)) & 0x030000ff;
+  v = (v | (v << 8)) & 0x0300f00f;
+  v = (v | (v << 4)) & 0x030c30c3;
+  v = (v | (v << 2)) & 0x09249249;
+  return v;
+}
+// 30-bit Morton code of 10-bit coordinates
+inline std::uint32_t morton3(std::uint32_t x, std::uint32_t y, std::uint32_t z)
+{
+  return morton_spread(x) | (morton_spread(y) << 1) | (morton_spread(z) << 2);
+}
+
+/*
+  sort key of a ray for coherent traversal
+
+    [ octant of direction : 3 ][ Morton of origin : 30 ][ Morton of dir : 30 ]
+
+  rays of same octant visit children in similar order,
+  and close origin and direction make them walk through the same nodes.
+  `bound` is the range of origins to quantize into 10 bits per axis.
+*/
+inline std::uint64_t coherence_key(Ray const& r, BoundingBox const& bound)
+{
+  const auto quantize = [](float v, float lo, float hi) -> std::uint32_t
+  {
+    if (!(hi > lo))
+    {
+      return 0;
+    }
+    const float q = (v - lo) / (hi - lo) * 1023.0f;
+    return (std::uint32_t)std::min(std::max(q, 0.0f), 1023.0f);
+  };
+  vec3 const& o = r.origin();
+  vec3 const& d = r.direction();
+  const std::uint64_t octant
+      = (d.x() < 0) | ((d.y() < 0) << 1) | ((d.z() < 0) << 2);
+  const std::uint64_t origin
+      = morton3(quantize(o.x(), bound.min_.x(), bound.max_.x()),
+                quantize(o.y(), bound.min_.y(), bound.max_.y()),
+                quantize(o.z(), bound.min_.z(), bound.max_.z()));
+  const std::uint64_t direction = morton3(quantize(d.x(), -1.0f, 1.0f),
+                                          quantize(d.y(), -1.0f, 1.0f),
+                                          quantize(d.z(), -1.0f, 1.0f));
+  return (octant << 60) | (origin << 30) | direction;
+}
+
+// indices of `rays` in order of coherence_key()
+inline void coherence_sort(std::vector<Ray> const& rays,
+                           std::vector<std::uint32_t>& order)
+{
+  BoundingBox bound = BoundingBox::empty();
+  for (auto const& r : rays)
+  {
+    bound = bound.merged(r.origin());
+  }
+  std::vector<std::pair<std::uint64_t, std::uint32_t>> keys(rays.size());
+  for (std::uint32_t i = 0; i < rays.size(); ++i)
+  {
+    keys[i] = { coherence_key(rays[i], bound), i };
+  }
+  std::sort(keys.begin(), keys.end());
+  order.resize(rays.size());
+  for (std::uint32_t i = 0; i < rays.size(); ++i)
+  {
+    order[i] = keys[i].second;
+  }
+}
+
+}
@@ -14,6 +14,32 @@ vec3 MirrorReflection::get_color(Ray const& r,
   newray.bounce = r.bounce + 0.3f;
   return w.get_color(newray).array() * color.array();
 }
+vec3 MirrorReflection::scatter(Ray const& r,
+                               RayHit const& hit,
+                               World&,
+                               std::vector<ScatterRay>& out) const
+{
+  Ray newray(hit.point(r), hit.reflect(r), r.thread_id);
+  newray.bounce = r.bounce + 0.3f;
+  out.push_back({ newray, color });
+  return vec3::Zero();
+}
+// random direction around the reflection, within cone of fuzzyness
+static vec3 fuzzy_direction(vec3 const& reflection,
+                            float fuzzyness,
+                            World& w,
+                            int thread_id)
+{
+  float angle = std::sin(w.random01(thread_id) * w.PI / 2.0f) * w.PI / 2.0f
+                * fuzzyness;
+  float angle2 = w.random01(thread_id) * w.PI * 2;
+  float x = std::cos(angle2) * std::sin(angle);
+  float y = std::sin(angle2) * std::sin(angle);
+  float z = std::cos(angle);
+  vec3 unitx, unity;
+  std::tie(unitx, unity) = make_unit(reflection);
+  return (x * unitx + y * unity + z * reflection).normalized();
+}
 vec3 FuzzyMirrorReflection::get_color(Ray const& r,
                                       RayHit const& hit,
                                       World& w) const
@@ -23,17 +49,8 @@ vec3 FuzzyMirrorReflection::get_color(Ray const& r,
   int cnt = 0;
   for (int i = 0; i < this->sample_count; ++i)
   {
-    float angle = std::sin(w.random01(r.thread_id) * w.PI / 2.0f) * w.PI / 2.0f
-                  * this->fuzzyness;
-    float angle2 = w.random01(r.thread_id) * w.PI * 2;
-    float x = std::cos(angle2) * std::sin(angle);
-    float y = std::sin(angle2) * std::sin(angle);
-    float z = std::cos(angle);
-    vec3 unitx, unity;
-    std::tie(unitx, unity) = make_unit(reflection);
-
     Ray newray(hit.point(r),
-               (x * unitx + y * unity + z * reflection).normalized(),
+               fuzzy_direction(reflection, fuzzyness, w, r.thread_id),
                r.thread_id);
     newray.bounce = r.bounce + 0.3;
     if (newray.direction().dot(hit.normal) < 0)
@@ -48,6 +65,55 @@ vec3 FuzzyMirrorReflection::get_color(Ray const& r,
 
   return color.array() * this->color.array();
 }
+vec3 FuzzyMirrorReflection::scatter(Ray const& r,
+                                    RayHit const& hit,
+                                    World& w,
+                                    std::vector<ScatterRay>& out) const
+{
+  const std::size_t first = out.size();
+  vec3 reflection = hit.reflect(r);
+  for (int i = 0; i < this->sample_count; ++i)
+  {
+    Ray newray(hit.point(r),
+               fuzzy_direction(reflection, fuzzyness, w, r.thread_id),
+               r.thread_id);
+    newray.bounce = r.bounce + 0.3;
+    if (newray.direction().dot(hit.normal) < 0)
+    {
+      continue;
+    }
+    out.push_back({ newray, vec3::Zero() });
+  }
+  // averaged over rays above the surface
+  const std::size_t cnt = out.size() - first;
+  const vec3 weight = color / (float)std::max<std::size_t>(cnt, 1);
+  for (std::size_t i = first; i < out.size(); ++i)
+  {
+    out[i].weight = weight;
+  }
+  return vec3::Zero();
+}
+
+// random direction on the hemisphere of normal
+static vec3 diffuse_direction(vec3 const& normal, World& w, int thread_id)
+{
+  float phi = w.random01(thread_id) * w.PI * 2;
+  float z = w.random01(thread_id);
+  float cos_2theta = 1.0 - 2 * z;
+  float cos_theta = std::sqrt((1.0 - cos_2theta) * 0.5f);
+  float sin_theta = std::sqrt((1.0f + cos_2theta) * 0.5f);
+  float sin_phi = std::sin(phi);
+  float cos_phi = std::cos(phi);
+
+  float x = sin_theta * cos_phi;
+  float y = sin_theta * sin_phi;
+  z = cos_theta;
+
+  // make unit vectors from normal vector
+  vec3 unitx, unity;
+  std::tie(unitx, unity) = make_unit(normal);
+  return x * unitx + y * unity + z * normal;
+}
 
 // Uniform Lambertial Diffusive Reflection
 vec3 DiffuseReflection::get_color(Ray const& r,
@@ -58,22 +124,8 @@ vec3 DiffuseReflection::get_color(Ray const& r,
   vec3 color = vec3::Zero();
   for (int i = 0; i < sample_count; ++i)
   {
-    float phi = w.random01(r.thread_id) * w.PI * 2;
-    float z = w.random01(r.thread_id);
-    float cos_2theta = 1.0 - 2 * z;
-    float cos_theta = std::sqrt((1.0 - cos_2theta) * 0.5f);
-    float sin_theta = std::sqrt((1.0f + cos_2theta) * 0.5f);
-    float sin_phi = std::sin(phi);
-    float cos_phi = std::cos(phi);
-
-    float x = sin_theta * cos_phi;
-    float y = sin_theta * sin_phi;
-    z = cos_theta;
-
-    // make unit vectors from normal vector
-    vec3 unitx, unity;
-    std::tie(unitx, unity) = make_unit(hit.normal);
-    Ray diffusive_ray(hit.point(r), x * unitx + y * unity + z * hit.normal,
+    Ray diffusive_ray(hit.point(r),
+                      diffuse_direction(hit.normal, w, r.thread_id),
                       r.thread_id);
     diffusive_ray.bounce = r.bounce + 1;
     color += w.get_color(diffusive_ray);
@@ -81,7 +133,35 @@ vec3 DiffuseReflection::get_color(Ray const& r,
   color = color / (float)sample_count;
   return color.array() * 0.5f * this->color.array();
 }
+vec3 DiffuseReflection::scatter(Ray const& r,
+                                RayHit const& hit,
+                                World& w,
+                                std::vector<ScatterRay>& out) const
+{
+  const vec3 weight = color * 0.5f / (float)sample_count;
+  for (int i = 0; i < sample_count; ++i)
+  {
+    Ray diffusive_ray(hit.point(r),
+                      diffuse_direction(hit.normal, w, r.thread_id),
+                      r.thread_id);
+    diffusive_ray.bounce = r.bounce + 1;
+    out.push_back({ diffusive_ray, weight });
+  }
+  return vec3::Zero();
+}
 vec3 Refragtion::get_color(Ray const& r, RayHit const& hit, World& w) const
+{
+  return w.get_color(refracted(r, hit)).array() * this->color.array();
+}
+vec3 Refragtion::scatter(Ray const& r,
+                         RayHit const& hit,
+                         World&,
+                         std::vector<ScatterRay>& out) const
+{
+  out.push_back({ refracted(r, hit), color });
+  return vec3::Zero();
+}
+Ray Refragtion::refracted(Ray const& r, RayHit const& hit) const
 {
   vec3 n = hit.normal * hit.normal.dot(r.direction());
   vec3 tangent = r.direction() - n;
@@ -98,8 +178,7 @@ vec3 Refragtion::get_color(Ray const& r, RayHit const& hit, World& w) const
     Ray newray(hit.point(r), tangent - n, r.thread_id);
     // newray.bounce = r.bounce;
     newray.bounce = r.bounce + 0.3f;
-    vec3 color = w.get_color(newray);
-    return color.array() * this->color.array();
+    return newray;
   }
   else
   {
@@ -108,8 +187,7 @@ vec3 Refragtion::get_color(Ray const& r, RayHit const& hit, World& w) const
 
     Ray newray(hit.point(r), (n + alpha * tangent).normalized(), r.thread_id);
     newray.bounce = r.bounce;
-    vec3 color = w.get_color(newray);
-    return color.array() * this->color.array();
+    return newray;
   }
 }
 
@@ -121,6 +199,21 @@ vec3 CombineReflection::get_color(Ray const& r,
   vec3 c2 = r2->get_color(r, hit, w);
   return c1 * s1 + c2 * s2;
 }
+vec3 CombineReflection::scatter(Ray const& r,
+                                RayHit const& hit,
+                                World& w,
+                                std::vector<ScatterRay>& out) const
+{
+  const std::size_t first = out.size();
+  const vec3 c1 = r1->scatter(r, hit, w, out);
+  const std::size_t second = out.size();
+  const vec3 c2 = r2->scatter(r, hit, w, out);
+  for (std::size_t i = first; i < out.size(); ++i)
+  {
+    out[i].weight *= i < second ? s1 : s2;
+  }
+  return c1 * s1 + c2 * s2;
+}
 vec3 MultiplyReflection::get_color(Ray const& r,
                                    RayHit const& hit,
                                    World& w) const
@@ -129,6 +222,34 @@ vec3 MultiplyReflection::get_color(Ray const& r,
   vec3 c2 = r2->get_color(r, hit, w);
   return c1.array() * c2.array();
 }
+vec3 MultiplyReflection::scatter(Ray const& r,
+                                 RayHit const& hit,
+                                 World& w,
+                                 std::vector<ScatterRay>& out) const
+{
+  const std::size_t first = out.size();
+  const vec3 c1 = r1->scatter(r, hit, w, out);
+  const std::size_t second = out.size();
+  const vec3 c2 = r2->scatter(r, hit, w, out);
+  if (second == first)
+  {
+    for (std::size_t i = second; i < out.size(); ++i)
+    {
+      out[i].weight = out[i].weight.cwiseProduct(c1);
+    }
+    return c1.cwiseProduct(c2);
+  }
+  if (second == out.size())
+  {
+    for (std::size_t i = first; i < second; ++i)
+    {
+      out[i].weight = out[i].weight.cwiseProduct(c2);
+    }
+    return c1.cwiseProduct(c2);
+  }
+  out.erase(out.begin() + first, out.end());
+  return get_color(r, hit, w);
+}
 vec3 FaceReflection::get_color(Ray const& r, RayHit const& hit, World& w) const
 {
   if (hit.normal.dot(r.direction()) < 0)
@@ -141,6 +262,21 @@ vec3 FaceReflection::get_color(Ray const& r, RayHit const& hit, World& w) const
   }
 }
 
+vec3 FaceReflection::scatter(Ray const& r,
+                             RayHit const& hit,
+                             World& w,
+                             std::vector<ScatterRay>& out) const
+{
+  if (hit.normal.dot(r.direction()) < 0)
+  {
+    return front->scatter(r, hit, w, out);
+  }
+  else
+  {
+    return back->scatter(r, hit, w, out);
+  }
+}
+
 vec3 LightSource::get_color(Ray const& r, RayHit const& hit, World& w) const
 {
   return this->color;
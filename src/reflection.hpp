@@ -2,10 +2,24 @@
 
 #include "global.hpp"
 #include "math.hpp"
+#include "ray.hpp"
+
+#include <cstdint>
+#include <vector>
 
 namespace eh
 {
 
+// secondary ray requested by ReflectionModel::scatter()
+// its color is multiplied by `weight` and added to the color of the hit
+struct ScatterRay
+{
+  Ray ray;
+  vec3 weight;
+  // index of the hit in the batch, set by scatter_batch()
+  std::uint32_t source = 0;
+};
+
 /*
   reflection model interface
 
@@ -43,29 +57,83 @@ struct ReflectionModel
   {
     return color;
   }
+
+  // non-recursive get_color() for wavefront rendering;
+  // instead of tracing secondary rays, push them to `out`.
+  // color = returned value + sum of ( weight * color of ray ) over `out`
+  // models that cannot be written so evaluate get_color() here
+  virtual vec3 scatter(Ray const& r,
+                       RayHit const& hit,
+                       World& world,
+                       std::vector<ScatterRay>&) const
+  {
+    return get_color(r, hit, world);
+  }
+
+  // scatter() for the hits rays[index[i]], hits[index[i]] with this model
+  // emitted[index[i]] is written, and rays pushed to `out` have
+  // source = index[i]
+  virtual void scatter_batch(Ray const* rays,
+                             RayHit const* hits,
+                             std::uint32_t const* index,
+                             std::size_t count,
+                             World& world,
+                             vec3* emitted,
+                             std::vector<ScatterRay>& out) const
+  {
+    for (std::size_t i = 0; i < count; ++i)
+    {
+      const std::uint32_t k = index[i];
+      const std::size_t first = out.size();
+      emitted[k] = scatter(rays[k], hits[k], world, out);
+      for (std::size_t j = first; j < out.size(); ++j)
+      {
+        out[j].source = k;
+      }
+    }
+  }
 };
 
 // fully mirrored reflection
 struct MirrorReflection : ReflectionModel
 {
   vec3 get_color(Ray const& r, RayHit const& hit, World& world) const override;
+  vec3 scatter(Ray const& r,
+               RayHit const& hit,
+               World& world,
+               std::vector<ScatterRay>& out) const override;
 };
 struct FuzzyMirrorReflection : ReflectionModel
 {
   float fuzzyness = 0.0f;
   vec3 get_color(Ray const& r, RayHit const& hit, World& world) const override;
+  vec3 scatter(Ray const& r,
+               RayHit const& hit,
+               World& world,
+               std::vector<ScatterRay>& out) const override;
 };
 
 // random diffuse reflection
 struct DiffuseReflection : ReflectionModel
 {
   vec3 get_color(Ray const& r, RayHit const& hit, World& world) const override;
+  vec3 scatter(Ray const& r,
+               RayHit const& hit,
+               World& world,
+               std::vector<ScatterRay>& out) const override;
 };
 
 struct Refragtion : ReflectionModel
 {
   float index = 1.0f;
   vec3 get_color(Ray const& r, RayHit const& hit, World& world) const override;
+  vec3 scatter(Ray const& r,
+               RayHit const& hit,
+               World& world,
+               std::vector<ScatterRay>& out) const override;
+
+  // secondary ray, reflected or refracted
+  Ray refracted(Ray const& r, RayHit const& hit) const;
 };
 
 struct CombineReflection : ReflectionModel
@@ -74,6 +142,10 @@ struct CombineReflection : ReflectionModel
   float s1 = 0.5f, s2 = 0.5f;
 
   vec3 get_color(Ray const& r, RayHit const& hit, World& world) const override;
+  vec3 scatter(Ray const& r,
+               RayHit const& hit,
+               World& world,
+               std::vector<ScatterRay>& out) const override;
 };
 
 struct MultiplyReflection : ReflectionModel
@@ -81,6 +153,12 @@ struct MultiplyReflection : ReflectionModel
   ReflectionModel *r1, *r2;
 
   vec3 get_color(Ray const& r, RayHit const& hit, World& world) const override;
+  // product is linear only if either one scatters no ray;
+  // otherwise get_color() is evaluated
+  vec3 scatter(Ray const& r,
+               RayHit const& hit,
+               World& world,
+               std::vector<ScatterRay>& out) const override;
 };
 
 // difference reflection model between front and back
@@ -88,6 +166,10 @@ struct FaceReflection : ReflectionModel
 {
   ReflectionModel *front, *back;
   vec3 get_color(Ray const& r, RayHit const& hit, World& world) const override;
+  vec3 scatter(Ray const& r,
+               RayHit const& hit,
+               World& world,
+               std::vector<ScatterRay>& out) const override;
 };
 
 // light source that omit constant light
@@ -0,0 +1,329 @@
+#pragma once
+
+#include "mapped_file.hpp"
+#include "mesh.hpp"
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <string>
+#include <type_traits>
+
+namespace eh
+{
+
+/*
+  binary cache of a built TriangleMesh
+
+  holds everything TriangleMesh::build() makes; vertices, faces,
+  material ids, frozen tree and triangle records, as raw arrays.
+  loading is a copy of each array out of the mapped file,
+  with no parsing and no tree construction.
+
+  file layout:
+
+    header    : mesh_cache_header_t, at offset 0
+    sections  : one raw array per section_id, each 64 bytes aligned
+
+  the cache is stale, and rejected on load, if
+    - the source file has different size or modification time,
+    - the caller's key, mesh.layout, mesh.treelet_bytes or
+      mesh.precompute_records differ,
+    - it was written by other version or by build with other type sizes.
+  material pointers are not stored; only ids.
+*/
+struct mesh_cache_header_t
+{
+  constexpr static std::uint32_t VERSION = 2;
+  constexpr static std::uint32_t ENDIAN_MARK = 0x01020304;
+  constexpr static std::size_t ALIGN = 64;
+
+  enum section_id
+  {
+    POSITIONS,
+    NORMALS,
+    FACES,
+    MATERIAL_IDS,
+    NODES,
+    DATA,
+    RECORDS,
+    SECTION_COUNT
+  };
+  struct section_t
+  {
+    std::uint64_t offset;
+    // the number of elements
+    std::uint64_t count;
+  };
+
+  char magic[8];
+  std::uint32_t version;
+  std::uint32_t endian_mark;
+
+  // source file it was built from
+  std::uint64_t source_size;
+  std::int64_t source_mtime;
+
+  // build settings
+  std::uint64_t key;
+  std::uint32_t layout;
+  std::uint32_t treelet_bytes;
+
+  // element size of each section, to reject cache of other build
+  std::uint32_t element_bytes[SECTION_COUNT];
+
+  float bound_min[3];
+  float bound_max[3];
+
+  section_t sections[SECTION_COUNT];
+
+  static void set_magic(char (&m)[8])
+  {
+    std::memcpy(m, "EHMESH\0\1", 8);
+  }
+
+  // element sizes of this build
+  static void element_sizes(std::uint32_t (&out)[SECTION_COUNT])
+  {
+    out[POSITIONS] = sizeof(vec3);
+    out[NORMALS] = sizeof(vec3);
+    out[FACES] = sizeof(TriangleMesh::face_t);
+    out[MATERIAL_IDS] = sizeof(TriangleMesh::material_index_type);
+    out[NODES] = sizeof(TriangleMesh::tree_type::node_type);
+    out[DATA] = sizeof(TriangleMesh::index_type);
+    out[RECORDS] = sizeof(TriangleMesh::record_t);
+  }
+};
+
+// write `mesh` into `filename`, stamped with the source file it came from
+// written to a temporary file first, then renamed over the old one
+inline bool save_mesh_cache(std::string const& filename,
+                            TriangleMesh const& mesh,
+                            FileStamp const& source,
+                            std::uint64_t key = 0)
+{
+  using header_t = mesh_cache_header_t;
+
+  header_t header;
+  std::memset(&header, 0, sizeof(header));
+  header_t::set_magic(header.magic);
+  header.version = header_t::VERSION;
+  header.endian_mark = header_t::ENDIAN_MARK;
+  header.source_size = source.size;
+  header.source_mtime = source.mtime;
+  header.key = key;
+  header.layout = static_cast<std::uint32_t>(mesh.layout);
+  header.treelet_bytes = mesh.treelet_bytes;
+  header_t::element_sizes(header.element_bytes);
+  for (int a = 0; a < 3; ++a)
+  {
+    header.bound_min[a] = mesh.bound.min_[a];
+    header.bound_max[a] = mesh.bound.max_[a];
+  }
+
+  void const* arrays[header_t::SECTION_COUNT] = {
+    mesh.positions.data(),    mesh.normals.data(),
+    mesh.faces.data(),        mesh.material_ids.data(),
+    mesh.tree.nodes().data(), mesh.tree.data().data(),
+    mesh.records.data(),
+  };
+  const std::size_t counts[header_t::SECTION_COUNT] = {
+    mesh.positions.size(),    mesh.normals.size(),
+    mesh.faces.size(),        mesh.material_ids.size(),
+    mesh.tree.nodes().size(), mesh.tree.data().size(),
+    mesh.records.size(),
+  };
+  const auto align = [](std::uint64_t offset)
+  {
+    return (offset + header_t::ALIGN - 1) / header_t::ALIGN
+           * header_t::ALIGN;
+  };
+  std::uint64_t offset = align(sizeof(header_t));
+  for (int s = 0; s < header_t::SECTION_COUNT; ++s)
+  {
+    header.sections[s].offset = offset;
+    header.sections[s].count = counts[s];
+    offset = align(offset + counts[s] * header.element_bytes[s]);
+  }
+
+  const std::string temp = filename + ".tmp";
+  {
+    std::ofstream ofs(temp, std::ios::binary | std::ios::trunc);
+    if (!ofs)
+    {
+      return false;
+    }
+    ofs.write(reinterpret_cast<char const*>(&header), sizeof(header));
+    const char zeros[header_t::ALIGN] = { 0 };
+    std::uint64_t written = sizeof(header);
+    for (int s = 0; s < header_t::SECTION_COUNT; ++s)
+    {
+      ofs.write(zeros, header.sections[s].offset - written);
+      const std::uint64_t bytes = counts[s] * header.element_bytes[s];
+      ofs.write(static_cast<char const*>(arrays[s]), bytes);
+      written = header.sections[s].offset + bytes;
+    }
+    ofs.write(zeros, offset - written);
+    if (!ofs)
+    {
+      std::remove(temp.c_str());
+      return false;
+    }
+  }
+  return std::rename(temp.c_str(), filename.c_str()) == 0;
+}
+
+// fill `mesh` from `filename` written by save_mesh_cache()
+// mesh.layout, mesh.treelet_bytes and mesh.precompute_records must be set
+// same as when saved.
+// returns false, leaving `mesh` untouched, if the cache is missing, stale
+// or corrupt
+inline bool load_mesh_cache(std::string const& filename,
+                            TriangleMesh& mesh,
+                            FileStamp const& source,
+                            std::uint64_t key = 0)
+{
+  using header_t = mesh_cache_header_t;
+
+  MappedFile file(filename);
+  if (file.is_open() == false || file.size() < sizeof(header_t))
+  {
+    return false;
+  }
+  header_t header;
+  std::memcpy(&header, file.data(), sizeof(header));
+
+  header_t expected;
+  header_t::set_magic(expected.magic);
+  header_t::element_sizes(expected.element_bytes);
+  if (std::memcmp(header.magic, expected.magic, sizeof(header.magic)) != 0
+      || header.version != header_t::VERSION
+      || header.endian_mark != header_t::ENDIAN_MARK
+      || std::memcmp(header.element_bytes, expected.element_bytes,
+                     sizeof(header.element_bytes))
+             != 0)
+  {
+    return false;
+  }
+  if (header.source_size != source.size || header.source_mtime != source.mtime
+      || header.key != key
+      || header.layout != static_cast<std::uint32_t>(mesh.layout)
+      || header.treelet_bytes != mesh.treelet_bytes
+      || (header.sections[header_t::RECORDS].count != 0)
+             != mesh.precompute_records)
+  {
+    return false;
+  }
+  // truncated file; sizes are compared by division, which can not overflow
+  for (int s = 0; s < header_t::SECTION_COUNT; ++s)
+  {
+    const std::uint64_t offset = header.sections[s].offset;
+    if (offset % header_t::ALIGN != 0 || offset > file.size()
+        || header.sections[s].count
+               > (file.size() - offset) / header.element_bytes[s]
+        || header.sections[s].count
+               > std::numeric_limits<TriangleMesh::index_type>::max())
+    {
+      return false;
+    }
+  }
+
+  using node_type = TriangleMesh::tree_type::node_type;
+  using face_t = TriangleMesh::face_t;
+  using index_type = TriangleMesh::index_type;
+  const auto pointer = [&](header_t::section_id s)
+  { return file.data() + header.sections[s].offset; };
+  const auto count = [&](header_t::section_id s)
+  { return static_cast<index_type>(header.sections[s].count); };
+
+  // sections must agree with each other, or traversal reads out of them
+  const index_type vertex_count = count(header_t::POSITIONS);
+  const index_type face_count = count(header_t::FACES);
+  if (count(header_t::NORMALS) != vertex_count
+      || (count(header_t::MATERIAL_IDS) != 0
+          && count(header_t::MATERIAL_IDS) != face_count)
+      || (count(header_t::RECORDS) != 0
+          && count(header_t::RECORDS) != face_count)
+      || count(header_t::DATA) != face_count
+      || (face_count != 0 && count(header_t::NODES) == 0))
+  {
+    return false;
+  }
+  face_t const* faces
+      = reinterpret_cast<face_t const*>(pointer(header_t::FACES));
+  for (index_type i = 0; i < face_count; ++i)
+  {
+    for (int k = 0; k < 3; ++k)
+    {
+      if (faces[i].v[k] >= vertex_count)
+      {
+        return false;
+      }
+    }
+  }
+  index_type const* data
+      = reinterpret_cast<index_type const*>(pointer(header_t::DATA));
+  for (index_type i = 0; i < face_count; ++i)
+  {
+    if (data[i] >= face_count)
+    {
+      return false;
+    }
+  }
+  node_type const* nodes
+      = reinterpret_cast<node_type const*>(pointer(header_t::NODES));
+  if (TriangleMesh::tree_type::valid(nodes, count(header_t::NODES),
+                                     face_count)
+      == false)
+  {
+    return false;
+  }
+
+  const auto section = [&](header_t::section_id s, auto& out)
+  {
+    using value_type = typename std::decay_t<decltype(out)>::value_type;
+    value_type const* first = reinterpret_cast<value_type const*>(pointer(s));
+    out.assign(first, first + count(s));
+  };
+  section(header_t::POSITIONS, mesh.positions);
+  section(header_t::NORMALS, mesh.normals);
+  section(header_t::FACES, mesh.faces);
+  section(header_t::MATERIAL_IDS, mesh.material_ids);
+  section(header_t::RECORDS, mesh.records);
+  mesh.tree.assign(nodes, count(header_t::NODES), data, face_count);
+  for (int a = 0; a < 3; ++a)
+  {
+    mesh.bound.min_[a] = header.bound_min[a];
+    mesh.bound.max_[a] = header.bound_max[a];
+  }
+  return true;
+}
+
+/*
+  load `mesh` from `cache` if it is up to date with `source`;
+  otherwise build it by load(mesh) and write the cache.
+  load( TriangleMesh& ) fills and builds the mesh, e.g. load_stl_mesh()
+  key: settings of load() that change the result, e.g. vertex normal flag
+  returns true if the cache was used
+*/
+template <typename Loader>
+bool load_mesh_cached(TriangleMesh& mesh,
+                      std::string const& source,
+                      std::string const& cache,
+                      Loader load,
+                      std::uint64_t key = 0)
+{
+  const FileStamp stamp = FileStamp::of(source);
+  if (load_mesh_cache(cache, mesh, stamp, key))
+  {
+    return true;
+  }
+  load(mesh);
+  // cache is only an optimization; failure to write it is not an error
+  save_mesh_cache(cache, mesh, stamp, key);
+  return false;
+}
+
+}
@@ -0,0 +1,555 @@
+#pragma once
+
+#include "geometry.hpp"
+#include "ray.hpp"
+#include "stack_traversal.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#if defined(__AVX__)
+  #include <immintrin.h>
+#elif defined(__SSE2__)
+  #include <emmintrin.h>
+#endif
+
+namespace eh
+{
+
+/*
+  frozen R-tree node with children bounds in structure-of-arrays layout.
+
+  each axis of children's min/max point is stored in a contiguous float array,
+  so a ray can be tested against all children at once;
+  8 children fit in one AVX register (two SSE registers) per axis.
+*/
+template <unsigned int Width>
+struct alignas(32) simd_node_t
+{
+  static_assert(Width % 4 == 0, "Width must be multiple of 4");
+
+  float min_[3][Width];
+  float max_[3][Width];
+
+  // child node index, or data index if this is leaf node
+  std::uint32_t children[Width];
+
+  // the number of children
+  std::uint32_t size;
+  bool leaf;
+};
+
+// ray broadcasted for simd_raycast
+struct simd_ray_t
+{
+  float origin[3];
+  float inv_direction[3];
+
+  simd_ray_t(Ray const& r)
+  {
+    for (int i = 0; i < 3; ++i)
+    {
+      origin[i] = r.origin()[i];
+      inv_direction[i] = r.inv_direction()[i];
+    }
+  }
+};
+
+// slab test of ray against all children of `node` in a single pass
+// hit is reported only if entry distance is in range [0, tmax]
+// returns bitmask of hit children, and entry distance of each is written on
+// `tnear`
+template <unsigned int Width>
+unsigned int simd_raycast(simd_node_t<Width> const& node,
+                          simd_ray_t const& ray,
+                          float tmax,
+                          float* tnear)
+{
+  unsigned int mask = 0;
+#if defined(__AVX__)
+  static_assert(Width % 8 == 0, "Width must be multiple of 8 for AVX");
+  __m256 o[3], inv[3];
+  for (int a = 0; a < 3; ++a)
+  {
+    o[a] = _mm256_set1_ps(ray.origin[a]);
+    inv[a] = _mm256_set1_ps(ray.inv_direction[a]);
+  }
+  for (unsigned int i = 0; i < Width; i += 8)
+  {
+    __m256 t0 = _mm256_setzero_ps();
+    __m256 t1 = _mm256_set1_ps(tmax);
+    for (int a = 0; a < 3; ++a)
+    {
+      const __m256 n = _mm256_mul_ps(
+          _mm256_sub_ps(_mm256_load_ps(node.min_[a] + i), o[a]), inv[a]);
+      const __m256 f = _mm256_mul_ps(
+          _mm256_sub_ps(_mm256_load_ps(node.max_[a] + i), o[a]), inv[a]);
+      // NaN (0*inf) is skipped as in BoundingBox::raycast; max/min return
+      // second operand on NaN, so NaN in `n` or `f` keeps t0 / t1 as is
+      t0 = _mm256_max_ps(_mm256_min_ps(f, n), t0);
+      t1 = _mm256_min_ps(_mm256_max_ps(n, f), t1);
+    }
+    _mm256_storeu_ps(tnear + i, t0);
+    mask |= (unsigned int)_mm256_movemask_ps(_mm256_cmp_ps(t0, t1, _CMP_LE_OQ))
+            << i;
+  }
+#elif defined(__SSE2__)
+  __m128 o[3], inv[3];
+  for (int a = 0; a < 3; ++a)
+  {
+    o[a] = _mm_set1_ps(ray.origin[a]);
+    inv[a] = _mm_set1_ps(ray.inv_direction[a]);
+  }
+  for (unsigned int i = 0; i < Width; i += 4)
+  {
+    __m128 t0 = _mm_setzero_ps();
+    __m128 t1 = _mm_set1_ps(tmax);
+    for (int a = 0; a < 3; ++a)
+    {
+      const __m128 n
+          = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.min_[a] + i), o[a]), inv[a]);
+      const __m128 f
+          = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.max_[a] + i), o[a]), inv[a]);
+      // NaN (0*inf) is skipped as in BoundingBox::raycast; max/min return
+      // second operand on NaN, so NaN in `n` or `f` keeps t0 / t1 as is
+      t0 = _mm_max_ps(_mm_min_ps(f, n), t0);
+      t1 = _mm_min_ps(_mm_max_ps(n, f), t1);
+    }
+    _mm_storeu_ps(tnear + i, t0);
+    mask |= (unsigned int)_mm_movemask_ps(_mm_cmple_ps(t0, t1)) << i;
+  }
+#else
+  for (unsigned int i = 0; i < Width; ++i)
+  {
+    float t0 = 0;
+    float t1 = tmax;
+    for (int a = 0; a < 3; ++a)
+    {
+      float n = (node.min_[a][i] - ray.origin[a]) * ray.inv_direction[a];
+      float f = (node.max_[a][i] - ray.origin[a]) * ray.inv_direction[a];
+      if (n > f)
+      {
+        std::swap(n, f);
+      }
+      t0 = std::max(t0, n);
+      t1 = std::min(t1, f);
+    }
+    tnear[i] = t0;
+    if (t0 <= t1)
+    {
+      mask |= 1u << i;
+    }
+  }
+#endif
+  // unused lanes
+  return mask & ((1u << node.size) - 1u);
+}
+
+// calls visit( i, tnear ) for children of `node` hit before tmax,
+// as stack_raycast() wants; tmax is tested again as it may get shorter
+template <unsigned int Width, typename Visit>
+bool simd_visit_children(simd_node_t<Width> const& node,
+                         simd_ray_t const& ray,
+                         float const& tmax,
+                         bool reverse,
+                         Visit visit)
+{
+  alignas(32) float tnear[Width];
+  unsigned int mask = simd_raycast(node, ray, tmax, tnear);
+  while (mask)
+  {
+    const int i = reverse ? 31 - __builtin_clz(mask) : __builtin_ctz(mask);
+    mask &= ~(1u << i);
+    if (tmax < tnear[i])
+    {
+      continue;
+    }
+    if (visit(i, tnear[i]))
+    {
+      return true;
+    }
+  }
+  return false;
+}
+
+/*
+  packet of N rays broadcasted for packet_raycast(), one ray per SIMD lane.
+
+  used for coherent rays (e.g. primary rays of one pixel) that would visit
+  mostly the same nodes; a node is fetched once for all rays of the packet.
+*/
+template <unsigned int N>
+struct alignas(32) ray_packet_t
+{
+  static_assert(N % 4 == 0, "N must be multiple of 4");
+
+  float origin[3][N];
+  float inv_direction[3][N];
+  // number of valid rays; lanes past this are copies of the first ray
+  unsigned int count;
+
+  ray_packet_t(Ray const* rays, unsigned int _count)
+      : count(_count)
+  {
+    assert(count > 0 && count <= N);
+    for (unsigned int k = 0; k < N; ++k)
+    {
+      Ray const& r = rays[k < count ? k : 0];
+      for (int a = 0; a < 3; ++a)
+      {
+        origin[a][k] = r.origin()[a];
+        inv_direction[a][k] = r.inv_direction()[a];
+      }
+    }
+  }
+};
+
+// slab test of all rays in `packet` against one box (bmin, bmax)
+// ray k hits if entry distance is in range [0, tmax[k]]
+// returns bitmask of hit rays
+template <unsigned int N>
+unsigned int packet_raycast(float const* bmin,
+                            float const* bmax,
+                            ray_packet_t<N> const& packet,
+                            float const* tmax)
+{
+  unsigned int mask = 0;
+  unsigned int k = 0;
+#if defined(__AVX__)
+  for (; k + 8 <= N; k += 8)
+  {
+    __m256 t0 = _mm256_setzero_ps();
+    __m256 t1 = _mm256_load_ps(tmax + k);
+    for (int a = 0; a < 3; ++a)
+    {
+      const __m256 o = _mm256_load_ps(packet.origin[a] + k);
+      const __m256 inv = _mm256_load_ps(packet.inv_direction[a] + k);
+      const __m256 n
+          = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(bmin[a]), o), inv);
+      const __m256 f
+          = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(bmax[a]), o), inv);
+      t0 = _mm256_max_ps(_mm256_min_ps(f, n), t0);
+      t1 = _mm256_min_ps(_mm256_max_ps(n, f), t1);
+    }
+    mask |= (unsigned int)_mm256_movemask_ps(_mm256_cmp_ps(t0, t1, _CMP_LE_OQ))
+            << k;
+  }
+#endif
+#if defined(__SSE2__)
+  for (; k + 4 <= N; k += 4)
+  {
+    __m128 t0 = _mm_setzero_ps();
+    __m128 t1 = _mm_load_ps(tmax + k);
+    for (int a = 0; a < 3; ++a)
+    {
+      const __m128 o = _mm_load_ps(packet.origin[a] + k);
+      const __m128 inv = _mm_load_ps(packet.inv_direction[a] + k);
+      const __m128 n = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(bmin[a]), o), inv);
+      const __m128 f = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(bmax[a]), o), inv);
+      t0 = _mm_max_ps(_mm_min_ps(f, n), t0);
+      t1 = _mm_min_ps(_mm_max_ps(n, f), t1);
+    }
+    mask |= (unsigned int)_mm_movemask_ps(_mm_cmple_ps(t0, t1)) << k;
+  }
+#endif
+  for (; k < N; ++k)
+  {
+    float t0 = 0;
+    float t1 = tmax[k];
+    for (int a = 0; a < 3; ++a)
+    {
+      float n = (bmin[a] - packet.origin[a][k]) * packet.inv_direction[a][k];
+      float f = (bmax[a] - packet.origin[a][k]) * packet.inv_direction[a][k];
+      if (n > f)
+      {
+        std::swap(n, f);
+      }
+      t0 = std::max(t0, n);
+      t1 = std::min(t1, f);
+    }
+    if (t0 <= t1)
+    {
+      mask |= 1u << k;
+    }
+  }
+  return mask;
+}
+
+// read-only R-tree made of simd_node_t, built from RTree::flatten() result
+template <typename MappedType, unsigned int Width = 8>
+class SIMDTree
+{
+public:
+  using mapped_type = MappedType;
+  using node_type = simd_node_t<Width>;
+  using size_type = std::uint32_t;
+
+protected:
+  std::vector<node_type> _nodes;
+  std::vector<mapped_type> _data;
+
+public:
+  // node indices are kept same as in flatten result
+  template <typename FlattenResult>
+  void build(FlattenResult const& tree)
+  {
+    _data = tree.data;
+    _nodes.clear();
+    _nodes.resize(tree.nodes.size());
+
+    // level of each node, to find out leaf nodes
+    std::vector<size_type> level(tree.nodes.size(), 0);
+    for (size_type n = 0; n < tree.nodes.size(); ++n)
+    {
+      auto const& src = tree.nodes[n];
+      node_type& dst = _nodes[n];
+      assert(src.size <= Width);
+
+      dst.size = src.size;
+      dst.leaf = level[n] == tree.leaf_level;
+      for (size_type i = 0; i < Width; ++i)
+      {
+        // unused lanes are masked out in simd_raycast()
+        BoundingBox bound = { vec3::Zero(), vec3::Zero() };
+        dst.children[i] = 0;
+        if (i < src.size)
+        {
+          bound = tree.children_bound[src.offset + i];
+          dst.children[i] = tree.children[src.offset + i];
+          if (dst.leaf == false)
+          {
+            level[dst.children[i]] = level[n] + 1;
+          }
+        }
+        for (int a = 0; a < 3; ++a)
+        {
+          dst.min_[a][i] = bound.min_[a];
+          dst.max_[a][i] = bound.max_[a];
+        }
+      }
+    }
+  }
+
+  // copy nodes and data made by build() before, e.g. from a file
+  void assign(node_type const* nodes,
+              size_type node_count,
+              mapped_type const* data,
+              size_type data_count)
+  {
+    _nodes.assign(nodes, nodes + node_count);
+    _data.assign(data, data + data_count);
+  }
+
+  // nodes copied from untrusted memory refer only to nodes after them
+  // and to data in range; so traversal from the root ends, within bounds
+  static bool
+  valid(node_type const* nodes, size_type node_count, size_type data_count)
+  {
+    for (size_type n = 0; n < node_count; ++n)
+    {
+      node_type const& node = nodes[n];
+      if (node.size > Width)
+      {
+        return false;
+      }
+      for (size_type i = 0; i < node.size; ++i)
+      {
+        const size_type c = node.children[i];
+        if (node.leaf ? c >= data_count : (c <= n || c >= node_count))
+        {
+          return false;
+        }
+      }
+    }
+    return true;
+  }
+
+  void clear()
+  {
+    _nodes.clear();
+    _data.clear();
+  }
+
+  std::vector<node_type> const& nodes() const
+  {
+    return _nodes;
+  }
+  std::vector<mapped_type> const& data() const
+  {
+    return _data;
+  }
+
+protected:
+  // children of node `index` hit before tmax, for stack_raycast()
+  template <typename Visit>
+  bool visit_children(size_type index,
+                      simd_ray_t const& ray,
+                      float const& tmax,
+                      bool reverse,
+                      TraversalStats* stats,
+                      Visit visit) const
+  {
+    node_type const& node = _nodes[index];
+    if (stats)
+    {
+      stats->visit_node(&node, sizeof(node));
+    }
+    return simd_visit_children(node, ray, tmax, reverse, visit);
+  }
+  mapped_type const&
+  visit_data(size_type index, int i, TraversalStats* stats) const
+  {
+    mapped_type const& data = _data[_nodes[index].children[i]];
+    if (stats)
+    {
+      stats->visit_primitive(&data, sizeof(mapped_type));
+    }
+    return data;
+  }
+
+public:
+
+  // any-hit traversal; returns true as soon as functor returns true
+  // functor( mapped_type const& ) tests if ray hits the data before tmax
+  template <typename Functor>
+  bool occluded(Ray const& ray,
+                float tmax,
+                Functor functor,
+                TraversalStats* stats = nullptr) const
+  {
+    if (_nodes.empty())
+    {
+      return false;
+    }
+    const simd_ray_t simd_ray(ray);
+    return stack_occluded(
+        size_type(0), tmax,
+        [&](size_type index) { return _nodes[index].leaf; },
+        [&](size_type index, float const& t, bool reverse, auto visit)
+        {
+          return visit_children(index, simd_ray, t, reverse, stats, visit);
+        },
+        [&](size_type index, int i) { return _nodes[index].children[i]; },
+        [&](size_type index, int i)
+        { return functor(visit_data(index, i, stats)); });
+  }
+
+  // closest-hit traversal of a ray packet; cur[k] is the hit of k'th ray
+  // functor( mapped_type const&, unsigned int k, RayHit& cur ) tests k'th ray
+  // against the data and updates `cur` if closer hit was found
+  // children are visited in storage order, only by rays that hit them
+  template <unsigned int N, typename Functor>
+  void raycast_packet(ray_packet_t<N> const& packet,
+                      RayHit* cur,
+                      Functor functor,
+                      TraversalStats* stats = nullptr) const
+  {
+    constexpr int STACK_SIZE = 256;
+    if (_nodes.empty())
+    {
+      return;
+    }
+
+    // closest hit of each lane; negative for unused lanes, so never hit
+    alignas(32) float tmax[N];
+    for (unsigned int k = 0; k < N; ++k)
+    {
+      tmax[k] = k < packet.count ? cur[k].t : -1.0f;
+    }
+
+    struct stack_entry_t
+    {
+      size_type index;
+      // rays that hit this node
+      unsigned int mask;
+    };
+    stack_entry_t stack[STACK_SIZE];
+    int stack_size = 0;
+    stack[stack_size++] = { 0, (1u << packet.count) - 1u };
+
+    float bmin[3], bmax[3];
+    const auto child_mask = [&](node_type const& node, unsigned int i)
+    {
+      for (int a = 0; a < 3; ++a)
+      {
+        bmin[a] = node.min_[a][i];
+        bmax[a] = node.max_[a][i];
+      }
+      return packet_raycast(bmin, bmax, packet, tmax);
+    };
+
+    while (stack_size > 0)
+    {
+      const stack_entry_t entry = stack[--stack_size];
+      node_type const& node = _nodes[entry.index];
+      if (stats)
+      {
+        stats->visit_node(&node, sizeof(node));
+      }
+
+      if (node.leaf)
+      {
+        for (unsigned int i = 0; i < node.size; ++i)
+        {
+          for (unsigned int mask = entry.mask & child_mask(node, i); mask;
+               mask &= mask - 1)
+          {
+            const int k = __builtin_ctz(mask);
+            if (stats)
+            {
+              stats->visit_primitive(&_data[node.children[i]],
+                                     sizeof(mapped_type));
+            }
+            functor(_data[node.children[i]], k, cur[k]);
+            tmax[k] = cur[k].t;
+          }
+        }
+        continue;
+      }
+
+      // push in reverse order; children are visited in storage order
+      for (int i = node.size - 1; i >= 0; --i)
+      {
+        const unsigned int mask = entry.mask & child_mask(node, i);
+        if (mask)
+        {
+          assert(stack_size < STACK_SIZE);
+          stack[stack_size++] = { node.children[i], mask };
+        }
+      }
+    }
+  }
+
+  // closest-hit traversal
+  // functor( mapped_type const&, RayHit& cur ) tests ray against the data
+  // and updates `cur` if closer hit was found
+  // ordered: visit children front-to-back by their entry distance
+  template <typename Functor>
+  void raycast(Ray const& ray,
+               RayHit& cur,
+               Functor functor,
+               bool ordered = false,
+               TraversalStats* stats = nullptr) const
+  {
+    if (_nodes.empty())
+    {
+      return;
+    }
+    const simd_ray_t simd_ray(ray);
+    stack_raycast(
+        size_type(0), cur, ordered,
+        [&](size_type index) { return _nodes[index].leaf; },
+        [&](size_type index, float const& t, bool reverse, auto visit)
+        {
+          return visit_children(index, simd_ray, t, reverse, stats, visit);
+        },
+        [&](size_type index, int i) { return _nodes[index].children[i]; },
+        [&](size_type index, int i, RayHit& hit)
+        { functor(visit_data(index, i, stats), hit); });
+  }
+};
+
+}
@@ -0,0 +1,142 @@
+#pragma once
+
+#include "ray.hpp"
+
+#include <cassert>
+
+namespace eh
+{
+
+/*
+  explicit-stack traversal shared by the frozen trees
+
+  the trees differ only in how the children of a node are tested,
+  so the loops here take that as functors:
+
+    leaf( Entry const& e )
+      true if children of node `e` are primitives
+    children( Entry const& e, float const& tmax, bool reverse, visit )
+      tests the ray against children bounds of node `e`, and calls
+      visit( int i, float tnear ) for i'th child hit before tmax,
+      in storage order or in reverse; tmax may get shorter meanwhile.
+      stops and returns true as soon as visit returns true.
+    child( Entry const& e, int i )
+      Entry of i'th child of internal node `e`
+*/
+constexpr int TRAVERSAL_STACK_SIZE = 256;
+
+// closest-hit traversal
+// primitive( Entry const& e, int i, RayHit& cur ) tests ray against
+// i'th primitive of leaf `e` and updates `cur` if closer hit was found
+// ordered: visit children front-to-back by their entry distance
+template <typename Entry,
+          typename Leaf,
+          typename Children,
+          typename Child,
+          typename Primitive>
+void stack_raycast(Entry const& root,
+                   RayHit& cur,
+                   bool ordered,
+                   Leaf leaf,
+                   Children children,
+                   Child child,
+                   Primitive primitive)
+{
+  struct stack_entry_t
+  {
+    Entry entry;
+    // entry distance of its bound
+    float t;
+  };
+  stack_entry_t stack[TRAVERSAL_STACK_SIZE];
+  int stack_size = 0;
+  stack[stack_size++] = { root, 0.0f };
+
+  while (stack_size > 0)
+  {
+    const stack_entry_t e = stack[--stack_size];
+    // closer hit was found after this node was pushed
+    if (cur.t < e.t)
+    {
+      continue;
+    }
+    if (leaf(e.entry))
+    {
+      children(e.entry, cur.t, false,
+               [&](int i, float)
+               {
+                 primitive(e.entry, i, cur);
+                 return false;
+               });
+      continue;
+    }
+
+    // push in reverse order; children are visited in storage order
+    const int pushed = stack_size;
+    children(e.entry, cur.t, true,
+             [&](int i, float t)
+             {
+               assert(stack_size < TRAVERSAL_STACK_SIZE);
+               stack[stack_size++] = { child(e.entry, i), t };
+               return false;
+             });
+    if (ordered)
+    {
+      // descending order of t; nearest on top
+      // insertion sort; at most one node's children
+      for (int i = pushed + 1; i < stack_size; ++i)
+      {
+        const stack_entry_t s = stack[i];
+        int j = i;
+        for (; j > pushed && stack[j - 1].t < s.t; --j)
+        {
+          stack[j] = stack[j - 1];
+        }
+        stack[j] = s;
+      }
+    }
+  }
+}
+
+// any-hit traversal; returns true as soon as primitive returns true
+// primitive( Entry const& e, int i ) tests if ray hits i'th primitive
+// of leaf `e` before tmax
+template <typename Entry,
+          typename Leaf,
+          typename Children,
+          typename Child,
+          typename Primitive>
+bool stack_occluded(Entry const& root,
+                    float tmax,
+                    Leaf leaf,
+                    Children children,
+                    Child child,
+                    Primitive primitive)
+{
+  Entry stack[TRAVERSAL_STACK_SIZE];
+  int stack_size = 0;
+  stack[stack_size++] = root;
+  while (stack_size > 0)
+  {
+    const Entry e = stack[--stack_size];
+    if (leaf(e))
+    {
+      if (children(e, tmax, false,
+                   [&](int i, float) { return primitive(e, i); }))
+      {
+        return true;
+      }
+      continue;
+    }
+    children(e, tmax, false,
+             [&](int i, float)
+             {
+               assert(stack_size < TRAVERSAL_STACK_SIZE);
+               stack[stack_size++] = child(e, i);
+               return false;
+             });
+  }
+  return false;
+}
+
+}
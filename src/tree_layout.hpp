@@ -0,0 +1,244 @@
+#pragma once
+
+#include <cstddef>
+#include <deque>
+#include <queue>
+#include <utility>
+#include <vector>
+
+namespace eh
+{
+
+// order of nodes in memory for RTree::flatten() result
+enum class TreeLayout
+{
+  // depth-first preorder; same as flatten()
+  DFS,
+  // breadth-first, level by level
+  BFS,
+  // van Emde Boas; top half of the tree, then each bottom subtree,
+  // recursively. good at every cache size without knowing it
+  VEB,
+  // greedy treelets of given node count, grown from the root by the
+  // largest surface area child; one treelet per cache line or page
+  Treelet,
+};
+
+/*
+  position of nodes of `tree` in given layout; order[new index] = old index
+
+  root stays at 0, and every parent is placed before its children,
+  as SIMDTree::build() and QuantizedTree::build() expect.
+  treelet_size: the number of nodes in a treelet, for TreeLayout::Treelet
+*/
+template <typename FlattenResult>
+std::vector<decltype(FlattenResult::root)>
+layout_order(FlattenResult const& tree,
+             TreeLayout layout,
+             std::size_t treelet_size = 1)
+{
+  using size_type = decltype(FlattenResult::root);
+
+  const size_type count = tree.nodes.size();
+  std::vector<size_type> order;
+  order.reserve(count);
+  if (count == 0)
+  {
+    return order;
+  }
+
+  // level of each node; parents come before children in flatten() result
+  std::vector<size_type> level(count, 0);
+  for (size_type n = 0; n < count; ++n)
+  {
+    auto const& node = tree.nodes[n];
+    if (level[n] == tree.leaf_level)
+    {
+      continue;
+    }
+    for (size_type i = node.offset; i < node.offset + node.size; ++i)
+    {
+      level[tree.children[i]] = level[n] + 1;
+    }
+  }
+  const auto is_leaf = [&](size_type n) { return level[n] == tree.leaf_level; };
+
+  switch (layout)
+  {
+  case TreeLayout::DFS:
+  {
+    std::vector<size_type> stack { tree.root };
+    while (stack.empty() == false)
+    {
+      const size_type n = stack.back();
+      stack.pop_back();
+      order.push_back(n);
+      if (is_leaf(n))
+      {
+        continue;
+      }
+      auto const& node = tree.nodes[n];
+      for (size_type i = node.offset + node.size; i-- > node.offset;)
+      {
+        stack.push_back(tree.children[i]);
+      }
+    }
+    break;
+  }
+  case TreeLayout::BFS:
+  {
+    order.push_back(tree.root);
+    for (size_type k = 0; k < order.size(); ++k)
+    {
+      const size_type n = order[k];
+      if (is_leaf(n))
+      {
+        continue;
+      }
+      auto const& node = tree.nodes[n];
+      for (size_type i = node.offset; i < node.offset + node.size; ++i)
+      {
+        order.push_back(tree.children[i]);
+      }
+    }
+    break;
+  }
+  case TreeLayout::VEB:
+  {
+    // nodes `depth` levels below n, in storage order
+    std::vector<size_type> frontier, next;
+    const auto descendants = [&](size_type n, size_type depth)
+    {
+      frontier.assign(1, n);
+      for (size_type d = 0; d < depth; ++d)
+      {
+        next.clear();
+        for (size_type f : frontier)
+        {
+          auto const& node = tree.nodes[f];
+          for (size_type i = node.offset; i < node.offset + node.size; ++i)
+          {
+            next.push_back(tree.children[i]);
+          }
+        }
+        frontier.swap(next);
+      }
+      return frontier;
+    };
+    // subtree of n, `height` levels
+    const auto veb = [&](auto& self, size_type n, size_type height) -> void
+    {
+      if (height == 1)
+      {
+        order.push_back(n);
+        return;
+      }
+      const size_type top = height / 2;
+      self(self, n, top);
+      for (size_type b : descendants(n, top))
+      {
+        self(self, b, height - top);
+      }
+    };
+    veb(veb, tree.root, tree.leaf_level + 1);
+    break;
+  }
+  case TreeLayout::Treelet:
+  {
+    if (treelet_size == 0)
+    {
+      treelet_size = 1;
+    }
+    // roots of treelets not placed yet
+    std::deque<size_type> roots { tree.root };
+    // candidates of current treelet, by surface area of its bound
+    std::priority_queue<std::pair<float, size_type>> candidates;
+    while (roots.empty() == false)
+    {
+      candidates.push({ 0.0f, roots.front() });
+      roots.pop_front();
+      for (std::size_t placed = 0;
+           placed < treelet_size && candidates.empty() == false; ++placed)
+      {
+        const size_type n = candidates.top().second;
+        candidates.pop();
+        order.push_back(n);
+        if (is_leaf(n))
+        {
+          continue;
+        }
+        auto const& node = tree.nodes[n];
+        for (size_type i = node.offset; i < node.offset + node.size; ++i)
+        {
+          candidates.push(
+              { tree.children_bound[i].surface_area(), tree.children[i] });
+        }
+      }
+      // the rest start their own treelets
+      while (candidates.empty() == false)
+      {
+        roots.push_back(candidates.top().second);
+        candidates.pop();
+      }
+    }
+    break;
+  }
+  }
+  return order;
+}
+
+// copy of `tree` with nodes placed in given layout;
+// children bounds follow their node, and data follows leaves in new order
+template <typename FlattenResult>
+FlattenResult relayout(FlattenResult const& tree,
+                       TreeLayout layout,
+                       std::size_t treelet_size = 1)
+{
+  using size_type = decltype(FlattenResult::root);
+
+  const std::vector<size_type> order
+      = layout_order(tree, layout, treelet_size);
+  std::vector<size_type> new_index(order.size());
+  for (size_type i = 0; i < order.size(); ++i)
+  {
+    new_index[order[i]] = i;
+  }
+
+  FlattenResult ret;
+  ret.leaf_level = tree.leaf_level;
+  ret.root = 0;
+  ret.nodes.resize(order.size());
+  ret.children_bound.reserve(tree.children_bound.size());
+  ret.children.reserve(tree.children.size());
+  ret.data.reserve(tree.data.size());
+
+  // level of each new node, to find out leaf nodes
+  std::vector<size_type> level(order.size(), 0);
+  for (size_type n = 0; n < order.size(); ++n)
+  {
+    auto const& src = tree.nodes[order[n]];
+    auto& dst = ret.nodes[n];
+    dst.offset = ret.children.size();
+    dst.size = src.size;
+    dst.parent = new_index[src.parent];
+    const bool leaf = level[n] == tree.leaf_level;
+    for (size_type i = src.offset; i < src.offset + src.size; ++i)
+    {
+      ret.children_bound.push_back(tree.children_bound[i]);
+      if (leaf)
+      {
+        ret.children.push_back(ret.data.size());
+        ret.data.push_back(tree.data[tree.children[i]]);
+      }
+      else
+      {
+        const size_type child = new_index[tree.children[i]];
+        ret.children.push_back(child);
+        level[child] = level[n] + 1;
+      }
+    }
+  }
+  return ret;
+}
+
+}
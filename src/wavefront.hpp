@@ -0,0 +1,302 @@
+#pragma once
+
+#include "math.hpp"
+#include "parallel.hpp"
+#include "ray.hpp"
+#include "ray_sort.hpp"
+#include "reflection.hpp"
+#include "world.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+namespace eh
+{
+
+/*
+  wavefront (stream) path tracer over World
+
+  World::render() traces each path recursively, pixel by pixel.
+  this keeps all rays of one bounce in a queue instead,
+  and runs each phase as a loop over the whole queue:
+
+    generate   : primary rays of every pixel
+    sort       : secondary rays reordered by direction and origin
+    intersect  : closest hit of every ray, in packets
+    shade      : hits grouped by material, scattered into the next queue
+    accumulate : emitted color of every hit added to its pixel
+
+  until the queue runs out. the image converges to the same one as
+  World::render(), but random numbers are drawn in different order.
+*/
+class WavefrontRenderer
+{
+public:
+  // rays of one bounce, in structure-of-arrays
+  struct ray_queue_t
+  {
+    std::vector<Ray> rays;
+    // product of scatter weights along the path from the eye
+    std::vector<vec3> throughput;
+    // index of framebuffer
+    std::vector<std::uint32_t> pixel;
+    // written by intersect phase
+    std::vector<RayHit> hits;
+    // written by shade phase
+    std::vector<vec3> emitted;
+
+    std::size_t size() const
+    {
+      return rays.size();
+    }
+    void clear()
+    {
+      rays.clear();
+      throughput.clear();
+      pixel.clear();
+      hits.clear();
+      emitted.clear();
+    }
+  };
+
+  World& world;
+
+  ray_queue_t current, next;
+  // indices of hits in `current`, sorted by material
+  std::vector<std::uint32_t> order;
+  // color of this sample for each pixel
+  std::vector<vec3> radiance;
+  // output of generate and shade phase for each thread;
+  // `source` is pixel index for primary rays, queue index otherwise
+  std::vector<std::vector<ScatterRay>> scattered;
+
+  // reorder secondary rays by coherence_key() before intersect phase;
+  // random bounces then walk the tree in similar order, sharing nodes.
+  // pays off once the tree does not fit in cache
+  bool sort_rays = false;
+
+  // pixels traced together in one wave;
+  // queue grows by sample_count of materials on every bounce
+  std::size_t tile_size = 256;
+
+  // the number of rays in each bounce of last render(), over all tiles
+  std::vector<std::size_t> queue_sizes;
+
+  WavefrontRenderer(World& _world)
+      : world(_world)
+  {
+  }
+
+  // one sample pass over the framebuffer, same as World::render()
+  // World::init() must be called before
+  void render()
+  {
+    const unsigned int thread_count = world.per_threads.size();
+    scattered.resize(thread_count);
+    radiance.assign(world.width * world.height, vec3::Zero());
+    queue_sizes.clear();
+
+    const std::size_t pixels = radiance.size();
+    for (std::size_t begin = 0; begin < pixels; begin += tile_size)
+    {
+      generate(begin, std::min(pixels, begin + tile_size));
+      enqueue(nullptr);
+      for (std::size_t bounce = 0; current.size() > 0; ++bounce)
+      {
+        if (queue_sizes.size() <= bounce)
+        {
+          queue_sizes.push_back(0);
+        }
+        queue_sizes[bounce] += current.size();
+        // primary rays are already in pixel order
+        if (sort_rays && bounce > 0)
+        {
+          sort();
+        }
+        intersect();
+        shade();
+        accumulate();
+        enqueue(&current);
+      }
+    }
+
+    // average new color data to old one
+    const float s = world.sample_count;
+    for (std::size_t i = 0; i < radiance.size(); ++i)
+    {
+      vec3& pixel = world.framebuffer[i];
+      if (world.sample_count == 0)
+      {
+        pixel = vec3::Zero();
+      }
+      pixel = pixel * (s / (s + 1)) + radiance[i] / (s + 1);
+    }
+    if (world.sample_count < 1000000)
+    {
+      ++world.sample_count;
+    }
+  }
+
+  // shoot_count jittered rays for each pixel in [first, last)
+  void generate(std::size_t first, std::size_t last)
+  {
+    const int width = world.width;
+    const int height = world.height;
+    const vec3 eye = world.camera(vec3(0, 0, 0));
+    const vec3 weight = vec3::Constant(1.0f / world.shoot_count);
+    parallel_chunks(
+        last - first,
+        [&](unsigned int t, std::size_t begin, std::size_t end)
+        {
+          auto& out = scattered[t];
+          for (std::size_t i = first + begin; i < first + end; ++i)
+          {
+            const int x = i % width;
+            const int y = i / width;
+            for (int k = 0; k < world.shoot_count; ++k)
+            {
+              float xf = (x + world.random01(t)) / (float)width;
+              float yf = (y + world.random01(t)) / (float)height;
+              vec3 point = world.camera(xf, yf);
+              out.push_back({ Ray(point, (point - eye).normalized(), t),
+                              weight, (std::uint32_t)i });
+            }
+          }
+        },
+        scattered.size());
+  }
+
+  // move scattered rays of all threads into `current`, in thread order
+  // parent: queue that the rays were scattered from; null for primary rays
+  void enqueue(ray_queue_t const* parent)
+  {
+    next.clear();
+    for (auto& out : scattered)
+    {
+      for (auto const& s : out)
+      {
+        // World::get_color() returns zero for these
+        if (s.ray.bounce >= world.max_bounce)
+        {
+          continue;
+        }
+        next.rays.push_back(s.ray);
+        if (parent)
+        {
+          next.throughput.push_back(
+              parent->throughput[s.source].cwiseProduct(s.weight));
+          next.pixel.push_back(parent->pixel[s.source]);
+        }
+        else
+        {
+          next.throughput.push_back(s.weight);
+          next.pixel.push_back(s.source);
+        }
+      }
+      out.clear();
+    }
+    std::swap(current, next);
+  }
+
+  // put rays of `current` in coherent order
+  void sort()
+  {
+    coherence_sort(current.rays, order);
+    next.clear();
+    for (std::uint32_t i : order)
+    {
+      next.rays.push_back(current.rays[i]);
+      next.throughput.push_back(current.throughput[i]);
+      next.pixel.push_back(current.pixel[i]);
+    }
+    std::swap(current, next);
+  }
+
+  // closest hit of every ray in `current`
+  void intersect()
+  {
+    constexpr unsigned int N = World::PACKET_SIZE;
+    current.hits.resize(current.size());
+    parallel_chunks(
+        current.size(),
+        [&](unsigned int t, std::size_t begin, std::size_t end)
+        {
+          for (std::size_t i = begin; i < end; ++i)
+          {
+            current.rays[i].thread_id = t;
+          }
+          // consecutive rays are from same pixel or same hit point
+          for (std::size_t i = begin; i < end; i += N)
+          {
+            const unsigned int count = std::min<std::size_t>(N, end - i);
+            world.raycast_packet<N>(current.rays.data() + i, count,
+                                    current.hits.data() + i);
+          }
+        },
+        scattered.size());
+  }
+
+  // scatter every hit of `current` by its material, a batch per material
+  void shade()
+  {
+    current.emitted.assign(current.size(), vec3::Zero());
+    order.clear();
+    for (std::uint32_t i = 0; i < current.size(); ++i)
+    {
+      if (current.hits[i].surface)
+      {
+        order.push_back(i);
+      }
+    }
+    std::sort(order.begin(), order.end(),
+              [&](std::uint32_t a, std::uint32_t b)
+              {
+                return std::less<ReflectionModel const*>()(material(a),
+                                                           material(b));
+              });
+
+    parallel_chunks(
+        order.size(),
+        [&](unsigned int t, std::size_t begin, std::size_t end)
+        {
+          for (std::size_t i = begin; i < end; ++i)
+          {
+            current.rays[order[i]].thread_id = t;
+          }
+          while (begin < end)
+          {
+            ReflectionModel const* m = material(order[begin]);
+            std::size_t last = begin + 1;
+            while (last < end && material(order[last]) == m)
+            {
+              ++last;
+            }
+            m->scatter_batch(current.rays.data(), current.hits.data(),
+                             order.data() + begin, last - begin, world,
+                             current.emitted.data(), scattered[t]);
+            begin = last;
+          }
+        },
+        scattered.size());
+  }
+
+  // add emitted color of every hit to its pixel
+  void accumulate()
+  {
+    for (std::uint32_t i : order)
+    {
+      radiance[current.pixel[i]]
+          += current.throughput[i].cwiseProduct(current.emitted[i]);
+    }
+  }
+
+  ReflectionModel const* material(std::uint32_t i) const
+  {
+    RayHit const& hit = current.hits[i];
+    return hit.material ? hit.material : hit.surface->reflect;
+  }
+};
+
+}
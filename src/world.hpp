@@ -8,14 +8,22 @@
 #include "reflection.hpp"
 
 #include <algorithm>
+#include <cassert>
 #include <chrono>
+#include <cmath>
 #include <iostream>
 #include <limits>
 #include <random>
 #include <thread>
 #include <vector>
 
+#include "bvh.hpp"
+#include "flat_tree.hpp"
+#include "parallel.hpp"
+#include "quantized_tree.hpp"
 #include "rtree_adapt.hpp"
+#include "simd_tree.hpp"
+#include "tree_layout.hpp"
 
 namespace eh
 {
@@ -33,9 +41,63 @@ struct Object
 class World
 {
 public:
-  using rtree_type = eh::rtree::RTree<BoundingBox, BoundingBox, Object, 4, 8>;
+  // nodes are carved from contiguous pages, and dropped all at once
+  // on clear() and bulk_load()
+  using rtree_type = eh::rtree::
+      RTree<BoundingBox, BoundingBox, Object, 4, 8, eh::rtree::arena_allocator>;
+  using bvh_type = BVH<Object>;
+  using simd_tree_type = SIMDTree<Object, rtree_type::MAX_ENTRIES>;
+  using quantized_tree_type
+      = QuantizedTree<Object, std::uint8_t, rtree_type::MAX_ENTRIES>;
+
+  // acceleration structure used by raycast()
+  enum class Accelerator
+  {
+    // R*-tree; objects can be inserted incrementally
+    RTree,
+    // read-only dense copy of the R*-tree made by freeze()
+    FlatRTree,
+    // FlatRTree with SoA children bounds, tested all at once by SIMD
+    SIMDRTree,
+    // SIMDRTree with children bounds quantized to 8 bits
+    QuantizedRTree,
+    // binned SAH bounding volume hierarchy; built only by build()
+    BVH,
+  };
+  Accelerator accelerator = Accelerator::RTree;
+
+  // visit children front-to-back by entry distance in R-tree traversal
+  bool ordered_traversal = false;
+
+  // count visited nodes and tested primitives per thread
+  bool collect_stats = false;
+
+  // node order of the tree made by freeze()
+  TreeLayout tree_layout = TreeLayout::DFS;
+  // size of a treelet for TreeLayout::Treelet; a page by default
+  std::size_t treelet_bytes = 4096;
+
+  // trace primary rays of a pixel together with raycast_packet();
+  // used only with Accelerator::SIMDRTree, the one tree that shares nodes
+  // between rays of a packet. off by default; other trees would trace
+  // them one by one anyway
+  bool packet_traversal = false;
+  // maximum number of rays in a packet
+  constexpr static unsigned int PACKET_SIZE = 8;
+
+  // trace each pixel ray as one path with trace_path(),
+  // instead of recursive get_color()
+  bool iterative_paths = false;
+  // paths longer than this many bounces survive by Russian roulette
+  int roulette_depth = 3;
+  // hard limit of path length; roulette ends paths long before this
+  int max_path_depth = 64;
 
   rtree_type objects;
+  rtree_type::flatten_result_t frozen;
+  simd_tree_type simd;
+  quantized_tree_type quantized;
+  bvh_type bvh;
 
   constexpr static float PI = 3.141592f;
 
@@ -62,6 +124,13 @@ public:
     std::thread thread;
 
     float calculation_time;
+
+    TraversalStats stats;
+
+    // scattered rays of one bounce in trace_path()
+    std::vector<ScatterRay> scattered;
+    // primary rays of one pixel in render_pixel(), with packet_traversal
+    std::vector<Ray> pixel_rays;
   };
   std::vector<per_thread_t> per_threads;
 
@@ -69,9 +138,177 @@ public:
 
   EyeAngle camera;
 
+  // SAH cost right after the last build(); refit() compares against this
+  // 0 if not known yet
+  float built_sah_cost = 0;
+
+  // objects kept out of the tree and tested against every ray:
+  // infinite bound (Plane), or bound enclosing all the others (sky sphere).
+  // either would make the root bound cover everything.
+  std::vector<Object> unbounded;
+  // put such objects into `unbounded` on insert() and build()
+  bool separate_unbounded = true;
+
   void insert(Object obj)
   {
-    objects.insert({ obj.geometry->bounding_box(), obj });
+    const BoundingBox bound = obj.geometry->bounding_box();
+    if (separate_unbounded && bound.is_finite() == false)
+    {
+      unbounded.push_back(obj);
+      return;
+    }
+    objects.insert({ bound, obj });
+    built_sah_cost = 0;
+  }
+  // rebuild whole scene at once with given acceleration structure
+  // this discards all previously inserted objects
+  void build(std::vector<Object> const& objs,
+             Accelerator accel = Accelerator::RTree)
+  {
+    std::vector<rtree_type::value_type> values;
+    values.reserve(objs.size());
+    for (auto const& obj : objs)
+    {
+      values.push_back({ obj.geometry->bounding_box(), obj });
+    }
+    unbounded.clear();
+    if (separate_unbounded)
+    {
+      separate_unbounded_values(values);
+    }
+
+    accelerator = accel;
+    const unsigned int threads = thread_count();
+    switch (accelerator)
+    {
+    case Accelerator::RTree:
+      bvh.clear();
+      objects.bulk_load(values.begin(), values.end(), threads);
+      break;
+    case Accelerator::FlatRTree:
+      bvh.clear();
+      objects.bulk_load(values.begin(), values.end(), threads);
+      freeze();
+      break;
+    case Accelerator::SIMDRTree:
+      bvh.clear();
+      objects.bulk_load(values.begin(), values.end(), threads);
+      freeze(Accelerator::SIMDRTree);
+      break;
+    case Accelerator::QuantizedRTree:
+      bvh.clear();
+      objects.bulk_load(values.begin(), values.end(), threads);
+      freeze(Accelerator::QuantizedRTree);
+      break;
+    case Accelerator::BVH:
+      objects.clear();
+      bvh.build(values.begin(), values.end(), threads);
+      break;
+    }
+    built_sah_cost = sah_cost();
+  }
+  // move infinite and scene-enclosing values out to `unbounded`
+  void separate_unbounded_values(std::vector<rtree_type::value_type>& values)
+  {
+    auto last = std::partition(values.begin(), values.end(),
+                               [](rtree_type::value_type const& v)
+                               { return v.first.is_finite(); });
+
+    // bound of all finite values except i-th one, from prefix and suffix
+    const size_t n = std::distance(values.begin(), last);
+    std::vector<BoundingBox> suffix(n + 1, BoundingBox::empty());
+    for (size_t i = n; i-- > 0;)
+    {
+      suffix[i] = suffix[i + 1].merged(values[i].first);
+    }
+    std::vector<bool> encloses(n);
+    BoundingBox prefix = BoundingBox::empty();
+    for (size_t i = 0; i < n; ++i)
+    {
+      const BoundingBox others = prefix.merged(suffix[i + 1]);
+      encloses[i] = values[i].first.is_inside(others);
+      prefix = prefix.merged(values[i].first);
+    }
+
+    size_t kept = 0;
+    for (size_t i = 0; i < n; ++i)
+    {
+      if (encloses[i] == false)
+      {
+        values[kept++] = values[i];
+      }
+      else
+      {
+        unbounded.push_back(values[i].second);
+      }
+    }
+    for (auto it = last; it != values.end(); ++it)
+    {
+      unbounded.push_back(it->second);
+    }
+    values.resize(kept);
+  }
+  // build again from objects currently in the scene, with fresh bounds
+  void rebuild()
+  {
+    std::vector<Object> objs = unbounded;
+    if (accelerator == Accelerator::BVH)
+    {
+      for (auto const& p : bvh.primitives())
+      {
+        objs.push_back(p.second);
+      }
+    }
+    else
+    {
+      objs.reserve(objs.size() + objects.size());
+      for (auto const& v : objects)
+      {
+        objs.push_back(v.second);
+      }
+    }
+    build(objs, accelerator);
+  }
+  // take a read-only snapshot of `objects` and render from it
+  // objects inserted after this call are not visible until next freeze()
+  // accel: FlatRTree, SIMDRTree or QuantizedRTree
+  void freeze(Accelerator accel = Accelerator::FlatRTree)
+  {
+    frozen = objects.flatten();
+    if (tree_layout != TreeLayout::DFS)
+    {
+      // bytes fetched for a node on traversal
+      std::size_t node_bytes
+          = sizeof(rtree_type::flatten_node_t)
+            + rtree_type::MAX_ENTRIES
+                  * (sizeof(BoundingBox) + sizeof(rtree_type::size_type));
+      if (accel == Accelerator::SIMDRTree)
+      {
+        node_bytes = sizeof(simd_tree_type::node_type);
+      }
+      else if (accel == Accelerator::QuantizedRTree)
+      {
+        node_bytes = sizeof(quantized_tree_type::node_type);
+      }
+      frozen = relayout(frozen, tree_layout, treelet_bytes / node_bytes);
+    }
+    simd.clear();
+    quantized.clear();
+    if (accel == Accelerator::SIMDRTree)
+    {
+      simd.build(frozen);
+    }
+    else if (accel == Accelerator::QuantizedRTree)
+    {
+      quantized.build(frozen);
+    }
+    accelerator = accel;
+  }
+  // threads for building trees; same as rendering once init() is called
+  unsigned int thread_count() const
+  {
+    return per_threads.empty() ? std::thread::hardware_concurrency()
+                               : per_threads.size();
   }
   float random01(int thread_id)
   {
@@ -140,12 +377,178 @@ public:
     sample_count = 0;
   }
 
+  // sum of traversal counters over all threads
+  TraversalStats traversal_stats() const
+  {
+    TraversalStats ret;
+    for (auto const& t : per_threads)
+    {
+      ret += t.stats;
+    }
+    return ret;
+  }
+  void reset_traversal_stats()
+  {
+    for (auto& t : per_threads)
+    {
+      t.stats.reset();
+    }
+  }
+  // simulate a cache of `bytes` for each thread, while collect_stats is on;
+  // node and primitive fetches missing it are counted in cache_misses.
+  // 0 to turn off
+  void simulate_cache(std::size_t bytes,
+                      unsigned int ways = 8,
+                      std::size_t line_size = 64)
+  {
+    for (auto& t : per_threads)
+    {
+      t.stats.cache.resize(bytes, ways, line_size);
+    }
+  }
+
+  // expected cost of a ray traversing the tree, up to a constant factor
+  // same measure as BVH::sah_cost(); unbounded nodes are skipped
+  float sah_cost() const
+  {
+    if (accelerator == Accelerator::BVH)
+    {
+      return bvh.sah_cost();
+    }
+    if (objects.size() == 0)
+    {
+      return 0;
+    }
+    float cost = 0;
+    const int leaf_level = objects.leaf_level();
+    for (int level = 1; level <= leaf_level; ++level)
+    {
+      for (auto it = objects.begin(level); it != objects.end(level); ++it)
+      {
+        const float area = it.node()->entry().first.surface_area();
+        if (std::isfinite(area) == false)
+        {
+          continue;
+        }
+        const int size
+            = level == leaf_level ? it.node()->as_leaf()->size() : 0;
+        cost += area
+                * (bvh_type::TRAVERSAL_COST
+                   + size * bvh_type::INTERSECTION_COST);
+      }
+    }
+    return cost;
+  }
+
+  // update bounds after geometries moved, keeping the tree topology.
+  // R-tree is refitted bottom-up, level by level; each level in parallel.
+  // frozen copies of the tree are rebuilt by freeze().
+  //
+  // rebuild_threshold: if positive, and SAH cost of the refitted tree
+  //                    exceeds this times the cost at last build(),
+  //                    the tree is rebuilt from scratch instead.
+  // returns true if rebuilt
+  bool refit(float rebuild_threshold = 0)
+  {
+    if (built_sah_cost == 0)
+    {
+      // bounds are not updated yet; this is the cost before moving
+      built_sah_cost = sah_cost();
+    }
+
+    if (accelerator == Accelerator::BVH)
+    {
+      bvh.refit([](Object const& obj)
+                { return obj.geometry->bounding_box(); });
+    }
+    else
+    {
+      refit_rtree();
+    }
+
+    if (rebuild_threshold > 0
+        && sah_cost() > rebuild_threshold * built_sah_cost)
+    {
+      rebuild();
+      return true;
+    }
+    if (accelerator != Accelerator::RTree && accelerator != Accelerator::BVH)
+    {
+      freeze(accelerator);
+    }
+    return false;
+  }
+  void refit_rtree()
+  {
+    if (objects.size() == 0)
+    {
+      return;
+    }
+    const unsigned int threads = thread_count();
+    const int leaf_level = objects.leaf_level();
+
+    // each node writes its bound only on its own entry of parent,
+    // so nodes on same level can be processed concurrently
+    std::vector<rtree_type::node_type*> nodes;
+    for (int level = leaf_level; level >= 0; --level)
+    {
+      nodes.assign(objects.begin(level), objects.end(level));
+      if (level == leaf_level)
+      {
+        parallel_for(
+            nodes.size(),
+            [&](std::size_t i)
+            {
+              auto* leaf = nodes[i]->as_leaf();
+              for (auto& c : *leaf)
+              {
+                c.first = c.second.geometry->bounding_box();
+              }
+              if (leaf->is_root() == false)
+              {
+                leaf->entry().first = leaf->calculate_bound();
+              }
+            },
+            threads);
+      }
+      else if (level > 0)
+      {
+        parallel_for(
+            nodes.size(),
+            [&](std::size_t i)
+            { nodes[i]->entry().first = nodes[i]->calculate_bound(); },
+            threads);
+      }
+    }
+  }
+
+  // raycast single object, update `cur` if it is closer
+  void raycast_object(Ray const& ray, Object const& obj, RayHit& cur)
+  {
+    auto raycast_result = obj.geometry->raycast(ray);
+    if (std::abs(raycast_result.normal.dot(ray.direction()))
+        < GeometryObject::EPSILON)
+    {
+      return;
+    }
+    if (raycast_result.surface && raycast_result.t < cur.t)
+    {
+      cur = raycast_result;
+      cur.surface = &obj;
+    }
+  }
+
   // raycasting in rtree dfs wrapper
   void rtree_raycast_wrapper(Ray const& ray,
                              rtree_type::node_type* node,
                              int leaf_level,
-                             RayHit& cur)
+                             RayHit& cur,
+                             TraversalStats* stats)
   {
+    if (stats)
+    {
+      stats->visit_node(node, sizeof(*node));
+    }
     if (leaf_level == 0)
     {
       // node is leaf node
@@ -160,17 +563,51 @@ public:
         {
           continue;
         }
-        auto raycast_result = c.second.geometry->raycast(ray);
-        if (std::abs(raycast_result.normal.dot(ray.direction()))
-            < GeometryObject::EPSILON)
+        if (stats)
+        {
+          stats->visit_primitive(&c, sizeof(c));
+        }
+        raycast_object(ray, c.second, cur);
+      }
+    }
+    else if (ordered_traversal)
+    {
+      // sort children by entry distance, visit front-to-back
+      std::pair<float, rtree_type::node_type*>
+          children[rtree_type::MAX_ENTRIES];
+      int count = 0;
+      for (auto& c : *node)
+      {
+        float tmin, tmax;
+        if (c.first.raycast(ray, tmin, tmax) == false)
+        {
+          continue;
+        }
+        if (cur.t < tmin)
         {
           continue;
         }
-        if (raycast_result.surface && raycast_result.t < cur.t)
+        children[count++] = { tmin, c.second->as_node() };
+      }
+      // insertion sort; at most MAX_ENTRIES children
+      for (int i = 1; i < count; ++i)
+      {
+        const auto c = children[i];
+        int j = i;
+        for (; j > 0 && c.first < children[j - 1].first; --j)
         {
-          cur = raycast_result;
-          cur.surface = &c.second;
+          children[j] = children[j - 1];
         }
+        children[j] = c;
+      }
+      for (int i = 0; i < count; ++i)
+      {
+        if (cur.t < children[i].first)
+        {
+          break;
+        }
+        rtree_raycast_wrapper(ray, children[i].second, leaf_level - 1, cur,
+                              stats);
       }
     }
     else
@@ -186,7 +623,8 @@ public:
         {
           continue;
         }
-        rtree_raycast_wrapper(ray, c.second->as_node(), leaf_level - 1, cur);
+        rtree_raycast_wrapper(ray, c.second->as_node(), leaf_level - 1, cur,
+                              stats);
       }
     }
   }
@@ -196,11 +634,175 @@ public:
   {
     RayHit ret;
     ret.t = std::numeric_limits<float>::max();
-    rtree_raycast_wrapper(ray, objects.root()->as_node(), objects.leaf_level(),
-                          ret);
+    TraversalStats* stats
+        = collect_stats ? &per_threads[ray.thread_id].stats : nullptr;
+    // first, so that their hit can cull the tree
+    for (auto const& obj : unbounded)
+    {
+      if (stats)
+      {
+        ++stats->primitives;
+      }
+      raycast_object(ray, obj, ret);
+    }
+    switch (accelerator)
+    {
+    case Accelerator::RTree:
+      rtree_raycast_wrapper(ray, objects.root()->as_node(),
+                            objects.leaf_level(), ret, stats);
+      break;
+    case Accelerator::FlatRTree:
+      flat_raycast(frozen, ray, ret,
+                   [&](Object const& obj, RayHit& cur)
+                   { raycast_object(ray, obj, cur); },
+                   ordered_traversal, stats);
+      break;
+    case Accelerator::SIMDRTree:
+      simd.raycast(ray, ret,
+                   [&](Object const& obj, RayHit& cur)
+                   { raycast_object(ray, obj, cur); },
+                   ordered_traversal, stats);
+      break;
+    case Accelerator::QuantizedRTree:
+      quantized.raycast(ray, ret,
+                        [&](Object const& obj, RayHit& cur)
+                        { raycast_object(ray, obj, cur); },
+                        ordered_traversal, stats);
+      break;
+    case Accelerator::BVH:
+      bvh.raycast(ray, ret,
+                  [&](Object const& obj, RayHit& cur)
+                  { raycast_object(ray, obj, cur); },
+                  stats);
+      break;
+    }
     return ret;
   }
 
+  // raycast `count` rays at once; hits[k] is set to the hit of rays[k]
+  // nodes are shared between rays on SIMDRTree,
+  // other accelerators trace rays one by one
+  template <unsigned int N = PACKET_SIZE>
+  void raycast_packet(Ray const* rays, unsigned int count, RayHit* hits)
+  {
+    assert(count <= N);
+    if (accelerator != Accelerator::SIMDRTree)
+    {
+      for (unsigned int k = 0; k < count; ++k)
+      {
+        hits[k] = raycast(rays[k]);
+      }
+      return;
+    }
+
+    TraversalStats* stats
+        = collect_stats ? &per_threads[rays[0].thread_id].stats : nullptr;
+    for (unsigned int k = 0; k < count; ++k)
+    {
+      // reset in place; copying a fresh RayHit reads its unset normal
+      hits[k].t = std::numeric_limits<float>::max();
+      hits[k].surface = nullptr;
+      hits[k].material = nullptr;
+      for (auto const& obj : unbounded)
+      {
+        if (stats)
+        {
+          ++stats->primitives;
+        }
+        raycast_object(rays[k], obj, hits[k]);
+      }
+    }
+    simd.raycast_packet(ray_packet_t<N>(rays, count), hits,
+                        [&](Object const& obj, unsigned int k, RayHit& cur)
+                        { raycast_object(rays[k], obj, cur); },
+                        stats);
+  }
+
+  // any-hit in rtree dfs wrapper
+  bool rtree_occluded_wrapper(Ray const& ray,
+                              float tmax,
+                              rtree_type::node_type* node,
+                              int leaf_level,
+                              TraversalStats* stats)
+  {
+    if (stats)
+    {
+      stats->visit_node(node, sizeof(*node));
+    }
+    if (leaf_level == 0)
+    {
+      for (auto& c : *node->as_leaf())
+      {
+        float t0, t1;
+        if (c.first.raycast(ray, t0, t1) == false || tmax < t0)
+        {
+          continue;
+        }
+        if (stats)
+        {
+          stats->visit_primitive(&c, sizeof(c));
+        }
+        if (c.second.geometry->occluded(ray, tmax))
+        {
+          return true;
+        }
+      }
+      return false;
+    }
+    for (auto& c : *node)
+    {
+      float t0, t1;
+      if (c.first.raycast(ray, t0, t1) == false || tmax < t0)
+      {
+        continue;
+      }
+      if (rtree_occluded_wrapper(ray, tmax, c.second->as_node(),
+                                 leaf_level - 1, stats))
+      {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // true if any object is hit by the ray before `tmax`;
+  // for shadow and visibility rays.
+  // traversal stops at the first hit found, in any order,
+  // and no normal or material of the hit is computed.
+  bool occluded(Ray const& ray, float tmax)
+  {
+    TraversalStats* stats
+        = collect_stats ? &per_threads[ray.thread_id].stats : nullptr;
+    const auto hit = [&](Object const& obj)
+    { return obj.geometry->occluded(ray, tmax); };
+    for (auto const& obj : unbounded)
+    {
+      if (stats)
+      {
+        ++stats->primitives;
+      }
+      if (hit(obj))
+      {
+        return true;
+      }
+    }
+    switch (accelerator)
+    {
+    case Accelerator::RTree:
+      return rtree_occluded_wrapper(ray, tmax, objects.root()->as_node(),
+                                    objects.leaf_level(), stats);
+    case Accelerator::FlatRTree:
+      return flat_occluded(frozen, ray, tmax, hit, stats);
+    case Accelerator::SIMDRTree:
+      return simd.occluded(ray, tmax, hit, stats);
+    case Accelerator::QuantizedRTree:
+      return quantized.occluded(ray, tmax, hit, stats);
+    case Accelerator::BVH:
+      return bvh.occluded(ray, tmax, hit, stats);
+    }
+    return false;
+  }
+
   // raytrace and get color from this ray
   vec3 get_color(Ray const& r)
   {
@@ -210,13 +812,85 @@ public:
       return vec3::Zero();
     }
 
-    auto hit = raycast(r);
+    return get_color(r, raycast(r));
+  }
+  // color from the hit of ray `r`, already traced
+  vec3 get_color(Ray const& r, RayHit const& hit)
+  {
     if (hit.surface == nullptr)
     {
       return vec3::Zero();
     }
 
-    return hit.surface->reflect->get_color(r, hit, *this);
+    ReflectionModel const* reflect
+        = hit.material ? hit.material : hit.surface->reflect;
+    return reflect->get_color(r, hit, *this);
+  }
+
+  /*
+    iterative path tracing; same image as get_color() with unlimited bounce
+
+    at every hit, the material scatters rays as in wavefront rendering,
+    and the path goes on with one of them, picked at random.
+    `throughput` carries the product of scatter weights from the eye,
+    and emitted color of each hit is added multiplied by it.
+    after roulette_depth bounces, the path ends with probability
+    1 - p, p = largest throughput component, and survivors are divided
+    by p; so dim paths end early, and the estimate stays unbiased.
+
+    max_bounce does not apply, except to a model that falls back to
+    get_color() in scatter()
+  */
+  vec3 trace_path(Ray const& r)
+  {
+    return trace_path(r, raycast(r));
+  }
+  // path from the first hit of `r`, already traced
+  vec3 trace_path(Ray const& r, RayHit const& first_hit)
+  {
+    const int thread_id = r.thread_id;
+    std::vector<ScatterRay>& scattered = per_threads[thread_id].scattered;
+    vec3 radiance = vec3::Zero();
+    vec3 throughput = vec3::Ones();
+    Ray ray = r;
+    RayHit hit = first_hit;
+    for (int depth = 0; hit.surface; ++depth)
+    {
+      ReflectionModel const* reflect
+          = hit.material ? hit.material : hit.surface->reflect;
+      scattered.clear();
+      radiance += throughput.cwiseProduct(
+          reflect->scatter(ray, hit, *this, scattered));
+      if (scattered.empty() || depth + 1 >= max_path_depth)
+      {
+        break;
+      }
+
+      // one of n rays, each with probability 1/n
+      const std::size_t n = scattered.size();
+      const std::size_t k = std::min<std::size_t>(
+          n - 1, static_cast<std::size_t>(random01(thread_id) * n));
+      throughput = throughput.cwiseProduct(scattered[k].weight) * (float)n;
+      if (throughput.maxCoeff() <= 0)
+      {
+        break;
+      }
+      if (depth + 1 >= roulette_depth)
+      {
+        const float p = std::min(0.95f, throughput.maxCoeff());
+        if (random01(thread_id) >= p)
+        {
+          break;
+        }
+        throughput /= p;
+      }
+
+      ray = scattered[k].ray;
+      // bounce only limits recursion of get_color() fallback
+      ray.bounce = 0;
+      hit = raycast(ray);
+    }
+    return radiance;
   }
 
   using clock_type = std::chrono::high_resolution_clock;
@@ -229,13 +903,52 @@ public:
     auto t0 = clock_type::now();
 
     vec3 color = vec3::Zero();
-    for (int k = 0; k < shoot_count; ++k)
+    if (packet_traversal && accelerator == Accelerator::SIMDRTree
+        && max_bounce > 0)
     {
-      float xf = (x + random01(thread_id)) / (float)width;
-      float yf = (y + random01(thread_id)) / (float)height;
-      vec3 point = camera(xf, yf);
-      Ray ray(point, (point - camera(vec3(0, 0, 0))).normalized(), thread_id);
-      color += get_color(ray);
+      // jittered rays of a pixel are traced together, in packets of
+      // 4 or 8 rays; then each is shaded one by one
+      std::vector<Ray>& rays = per_threads[thread_id].pixel_rays;
+      rays.clear();
+      for (int k = 0; k < shoot_count; ++k)
+      {
+        float xf = (x + random01(thread_id)) / (float)width;
+        float yf = (y + random01(thread_id)) / (float)height;
+        vec3 point = camera(xf, yf);
+        rays.emplace_back(point, (point - camera(vec3(0, 0, 0))).normalized(),
+                          thread_id);
+      }
+      RayHit hits[PACKET_SIZE];
+      for (int k = 0; k < shoot_count; k += PACKET_SIZE)
+      {
+        const unsigned int count
+            = std::min<unsigned int>(PACKET_SIZE, shoot_count - k);
+        if (count <= 4)
+        {
+          raycast_packet<4>(rays.data() + k, count, hits);
+        }
+        else
+        {
+          raycast_packet<8>(rays.data() + k, count, hits);
+        }
+        for (unsigned int j = 0; j < count; ++j)
+        {
+          color += iterative_paths ? trace_path(rays[k + j], hits[j])
+                                   : get_color(rays[k + j], hits[j]);
+        }
+      }
+    }
+    else
+    {
+      for (int k = 0; k < shoot_count; ++k)
+      {
+        float xf = (x + random01(thread_id)) / (float)width;
+        float yf = (y + random01(thread_id)) / (float)height;
+        vec3 point = camera(xf, yf);
+        Ray ray(point, (point - camera(vec3(0, 0, 0))).normalized(),
+                thread_id);
+        color += iterative_paths ? trace_path(ray) : get_color(ray);
+      }
     }
     color /= shoot_count;
 